@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "binary-log.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+char const kMagic[6] = {'C', 'F', 'B', 'L', 'O', 'G'};
+uint16_t const kVersion{1};
+
+// The writer sleeps this long when the ring is empty
+std::chrono::milliseconds const kWritePeriod{20};
+
+// In the order of TraceEvent and ThreadRole
+char const *const kTraceEventNames[] = {"transmit", "ping", "dequeue", "command send", "log callback", "od4 send", "enqueue", "recovery"};
+char const *const kThreadRoleNames[] = {"main", "od4", "radio", "recovery"};
+// In the order of LogEvent, all but traces and thread names become instant
+// events
+char const *const kLogEventNames[] = {"command received", "command sent", "pose", "trace", "thread name", "trajectory uploaded"};
+
+template <size_t N>
+char const *nameOf(char const *const (&names)[N], float value)
+{
+    uint32_t const index{static_cast<uint32_t>(value)};
+    return (index < N) ? names[index] : "unknown";
+}
+}
+
+BinaryLog::BinaryLog(uint32_t capacity)
+  : m_cells()
+  , m_mask(0)
+  , m_file(nullptr)
+  , m_isOpen(false)
+  , m_isTracing(false)
+  , m_running(false)
+  , m_thread()
+{
+    uint64_t size{2};
+    while (size < capacity) {
+        size <<= 1;
+    }
+    m_mask = size - 1;
+    m_cells.reset(new Cell[size]);
+    for (uint64_t i{0}; i < size; i++) {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+BinaryLog::~BinaryLog()
+{
+    close();
+}
+
+void BinaryLog::open(std::string const &filename)
+{
+    m_file = std::fopen(filename.c_str(), "wb");
+    if ( nullptr == m_file ){
+        throw std::runtime_error("Could not create the log file " + filename + ": " + std::strerror(errno));
+    }
+    uint32_t const recordSize{sizeof(LogRecord)};
+    std::fwrite(kMagic, sizeof(kMagic), 1, m_file);
+    std::fwrite(&kVersion, sizeof(kVersion), 1, m_file);
+    std::fwrite(&recordSize, sizeof(recordSize), 1, m_file);
+
+    m_running = true;
+    m_thread = std::thread(&BinaryLog::run, this);
+    m_isOpen = true;
+}
+
+void BinaryLog::close()
+{
+    m_isOpen = false;
+    m_isTracing = false;
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    if ( nullptr != m_file ){
+        drain();
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+bool BinaryLog::isOpen() const noexcept
+{
+    return m_isOpen.load(std::memory_order_relaxed);
+}
+
+void BinaryLog::enableTracing() noexcept
+{
+    m_isTracing = m_isOpen.load();
+}
+
+bool BinaryLog::isTracing() const noexcept
+{
+    return m_isTracing.load(std::memory_order_relaxed);
+}
+
+void BinaryLog::trace(TraceEvent event, int16_t frameId, int64_t beginUs, int64_t endUs, float argument) noexcept
+{
+    if ( !isTracing() ){
+        return;
+    }
+    append(beginUs, LogEvent::Trace, frameId, {static_cast<float>(event), static_cast<float>(endUs - beginUs), static_cast<float>(threadIndex()), argument});
+}
+
+void BinaryLog::nameThread(ThreadRole role) noexcept
+{
+    thread_local bool isNamed{false};
+    if ( isNamed || !isTracing() ){
+        return;
+    }
+    isNamed = true;
+    append(nowUs(), LogEvent::ThreadName, -1, {static_cast<float>(role), static_cast<float>(threadIndex())});
+}
+
+void BinaryLog::log(LogEvent event, int16_t frameId, std::initializer_list<float> values) noexcept
+{
+    if ( !m_isOpen.load(std::memory_order_relaxed) ){
+        return;
+    }
+    append(nowUs(), event, frameId, values);
+}
+
+uint64_t BinaryLog::dropped() const noexcept
+{
+    return m_dropped.load(std::memory_order_relaxed);
+}
+
+int64_t BinaryLog::nowUs() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+uint32_t BinaryLog::threadIndex() noexcept
+{
+    static std::atomic<uint32_t> threads{0};
+    thread_local uint32_t const index{threads.fetch_add(1)};
+    return index;
+}
+
+void BinaryLog::append(int64_t timeUs, LogEvent event, int16_t frameId, std::initializer_list<float> values) noexcept
+{
+    // Claim a cell like CommandQueue::push does
+    Cell *cell{nullptr};
+    uint64_t pos{m_enqueuePos.load(std::memory_order_relaxed)};
+    for (;;) {
+        cell = &m_cells[pos & m_mask];
+        uint64_t const seq{cell->sequence.load(std::memory_order_acquire)};
+        int64_t const diff{static_cast<int64_t>(seq) - static_cast<int64_t>(pos)};
+        if ( 0 == diff ){
+            if ( m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) ){
+                break;
+            }
+        } else if ( diff < 0 ){
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+    LogRecord &record = cell->record;
+    record.timeUs = timeUs;
+    record.event = static_cast<uint16_t>(event);
+    record.frameId = frameId;
+    uint32_t i{0};
+    for (float const value : values) {
+        if ( i >= kLogRecordValues ){
+            break;
+        }
+        record.values[i++] = value;
+    }
+    for (; i < kLogRecordValues; i++) {
+        record.values[i] = 0.0f;
+    }
+    cell->sequence.store(pos + 1, std::memory_order_release);
+}
+
+void BinaryLog::run()
+{
+    while (m_running) {
+        if ( 0 == drain() ){
+            std::this_thread::sleep_for(kWritePeriod);
+        }
+    }
+}
+
+uint64_t BinaryLog::drain()
+{
+    std::vector<LogRecord> batch;
+    for (;;) {
+        Cell &cell = m_cells[m_dequeuePos & m_mask];
+        if ( cell.sequence.load(std::memory_order_acquire) != m_dequeuePos + 1 ){
+            break;
+        }
+        batch.push_back(cell.record);
+        cell.sequence.store(m_dequeuePos + m_mask + 1, std::memory_order_release);
+        m_dequeuePos++;
+    }
+    if ( !batch.empty() ){
+        std::fwrite(batch.data(), sizeof(LogRecord), batch.size(), m_file);
+        std::fflush(m_file);
+    }
+    return batch.size();
+}
+
+void readLogHeader(std::istream &in)
+{
+    char magic[sizeof(kMagic)];
+    uint16_t version{0};
+    uint32_t recordSize{0};
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char *>(&version), sizeof(version));
+    in.read(reinterpret_cast<char *>(&recordSize), sizeof(recordSize));
+    if ( !in || !std::equal(magic, magic + sizeof(magic), kMagic) ){
+        throw std::runtime_error("Not a binary log");
+    }
+    if ( version != kVersion || recordSize != sizeof(LogRecord) ){
+        throw std::runtime_error("Binary log version " + std::to_string(version) + " is not supported");
+    }
+}
+
+bool readLogRecord(std::istream &in, LogRecord &record)
+{
+    in.read(reinterpret_cast<char *>(&record), sizeof(record));
+    return in.gcount() == sizeof(record);
+}
+
+std::string toText(LogRecord const &record)
+{
+    std::ostringstream text;
+    text << record.timeUs / 1000000 << "." << std::setw(6) << std::setfill('0') << record.timeUs % 1000000 << std::setfill(' ') << " frame " << record.frameId << ": ";
+    float const *v{record.values};
+    switch (static_cast<LogEvent>(record.event)) {
+        case LogEvent::CommandReceived:
+            text << "command received with type " << v[0] << ", scope " << v[1] << ", target " << v[2];
+            break;
+        case LogEvent::CommandSent:
+            text << "command sent with type " << v[0] << ", attempt " << v[1];
+            break;
+        case LogEvent::Pose:
+            text << "x:" << v[0] << ", y:" << v[1] << ", z:" << v[2] << ", roll:" << v[3] << ", pitch:" << v[4] << ", yaw:" << v[5] << ", voltage:" << v[6];
+            break;
+        case LogEvent::TrajectoryUploaded:
+            text << "trajectory " << v[0] << " uploaded with " << v[1] << " pieces in " << v[2] << " ms";
+            break;
+        case LogEvent::Trace:
+            text << nameOf(kTraceEventNames, v[0]) << " (" << v[3] << ") on thread " << v[2] << " for " << v[1] << " us";
+            break;
+        case LogEvent::ThreadName:
+            text << "thread " << v[1] << " is " << nameOf(kThreadRoleNames, v[0]);
+            break;
+        default:
+            text << "event " << record.event;
+            for (uint32_t i{0}; i < kLogRecordValues; i++) {
+                text << " " << v[i];
+            }
+            break;
+    }
+    return text.str();
+}
+
+std::string toChromeTrace(LogRecord const &record)
+{
+    std::ostringstream event;
+    float const *v{record.values};
+    switch (static_cast<LogEvent>(record.event)) {
+        case LogEvent::Trace:
+            event << "{\"name\":\"" << nameOf(kTraceEventNames, v[0]) << "\",\"ph\":\"X\",\"ts\":" << record.timeUs << ",\"dur\":" << static_cast<int64_t>(v[1]) << ",\"pid\":1,\"tid\":" << static_cast<uint32_t>(v[2]) << ",\"args\":{\"frame\":" << record.frameId << ",\"argument\":" << v[3] << "}}";
+            break;
+        case LogEvent::ThreadName:
+            event << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << static_cast<uint32_t>(v[1]) << ",\"args\":{\"name\":\"" << nameOf(kThreadRoleNames, v[0]) << " " << static_cast<uint32_t>(v[1]) << "\"}}";
+            break;
+        default:
+            event << "{\"name\":\"" << nameOf(kLogEventNames, record.event) << "\",\"ph\":\"i\",\"s\":\"g\",\"ts\":" << record.timeUs << ",\"pid\":1,\"tid\":0,\"args\":{\"frame\":" << record.frameId;
+            for (uint32_t i{0}; i < kLogRecordValues; i++) {
+                event << ",\"v" << i << "\":" << v[i];
+            }
+            event << "}}";
+            break;
+    }
+    return event.str();
+}
+
+TraceScope::TraceScope(BinaryLog &log, TraceEvent event, int16_t frameId, float argument) noexcept
+  : m_log(log)
+  , m_event(event)
+  , m_frameId(frameId)
+  , m_argument(argument)
+  , m_beginUs(log.isTracing() ? BinaryLog::nowUs() : 0)
+{
+}
+
+TraceScope::~TraceScope()
+{
+    if ( 0 != m_beginUs ){
+        m_log.trace(m_event, m_frameId, m_beginUs, BinaryLog::nowUs(), m_argument);
+    }
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BINARY_LOG_HPP
+#define BINARY_LOG_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <istream>
+#include <memory>
+#include <string>
+#include <thread>
+
+// What a record is about, and what its values are.
+enum class LogEvent : uint16_t {
+  // Command type, scope and target of its address, see command-address.hpp
+  CommandReceived = 0,
+  // Command type, attempt, or the repeats of a broadcast (frameId -1)
+  CommandSent = 1,
+  // x, y, z, roll, pitch, yaw, battery voltage
+  Pose = 2,
+  // TraceEvent, duration in microseconds, thread, argument; the record
+  // time is the start
+  Trace = 3,
+  // ThreadRole, thread
+  ThreadName = 4,
+  // Trajectory id, pieces, duration of the upload in milliseconds
+  TrajectoryUploaded = 5
+};
+
+// Spans on the timeline of a trace.
+enum class TraceEvent : uint16_t {
+  // One packet of a link, argument is the TrafficClass
+  Transmit = 0,
+  Ping = 1,
+  // Taking a command from the queue
+  Dequeue = 2,
+  // Sending a command over the radio, argument is its type
+  CommandSend = 3,
+  // Turning a log block packet into messages
+  LogCallback = 4,
+  // argument is the message ID
+  Od4Send = 5,
+  // Putting a received command into the queues, argument is its type
+  Enqueue = 6,
+  // argument is the recovery phase
+  Recovery = 7
+};
+
+// What a thread does, to name it on the timeline.
+enum class ThreadRole : uint16_t {
+  Main = 0,
+  Od4 = 1,
+  Radio = 2,
+  Recovery = 3
+};
+
+constexpr uint32_t kLogRecordValues{7};
+
+// One entry of the log file, time in microseconds since the epoch.
+struct LogRecord {
+  int64_t timeUs;
+  uint16_t event;
+  int16_t frameId;
+  float values[kLogRecordValues];
+};
+static_assert(sizeof(LogRecord) == 40, "LogRecord is written to files as it is");
+
+// Log for the threads that must not wait: a record is copied into a
+// lock-free ring buffer, and a writer thread appends the records to a file
+// in batches. Records that do not fit into the ring are dropped and
+// counted. The file starts with the magic "CFBLOG", a 16 bit version and
+// the 32 bit record size, followed by the records in host byte order.
+// Logging to a log that is not open costs a load and a branch.
+//
+// With tracing enabled, TraceScope adds spans to the log that the decoder
+// turns into a Chrome trace, which chrome://tracing and Perfetto show as a
+// timeline per thread.
+class BinaryLog {
+ private:
+  BinaryLog(const BinaryLog &) = delete;
+  BinaryLog(BinaryLog &&) = delete;
+  BinaryLog &operator=(const BinaryLog &) = delete;
+  BinaryLog &operator=(BinaryLog &&) = delete;
+
+ public:
+  // The capacity is rounded up to the next power of two.
+  explicit BinaryLog(uint32_t capacity);
+  ~BinaryLog();
+
+  // Throws std::runtime_error if the file cannot be created.
+  void open(std::string const &filename);
+  // Writes what is left in the ring and closes the file.
+  void close();
+  bool isOpen() const noexcept;
+  // Only takes effect while the log is open.
+  void enableTracing() noexcept;
+  bool isTracing() const noexcept;
+
+  // May be called from any thread, values beyond kLogRecordValues are cut.
+  void log(LogEvent event, int16_t frameId, std::initializer_list<float> values) noexcept;
+  void trace(TraceEvent event, int16_t frameId, int64_t beginUs, int64_t endUs, float argument) noexcept;
+  // Names the calling thread once, later calls are ignored.
+  void nameThread(ThreadRole role) noexcept;
+  uint64_t dropped() const noexcept;
+
+  static int64_t nowUs() noexcept;
+
+ private:
+  struct Cell {
+    std::atomic<uint64_t> sequence{0};
+    LogRecord record{};
+  };
+
+  // Small number of the calling thread, counted from 0
+  static uint32_t threadIndex() noexcept;
+  void append(int64_t timeUs, LogEvent event, int16_t frameId, std::initializer_list<float> values) noexcept;
+  void run();
+  // Writes the records in the ring to the file, returns how many.
+  uint64_t drain();
+
+  std::unique_ptr<Cell[]> m_cells;
+  uint64_t m_mask;
+  std::atomic<uint64_t> m_enqueuePos{0};
+  uint64_t m_dequeuePos{0};
+  std::atomic<uint64_t> m_dropped{0};
+
+  std::FILE *m_file;
+  std::atomic<bool> m_isOpen;
+  std::atomic<bool> m_isTracing;
+  std::atomic<bool> m_running;
+  std::thread m_thread;
+};
+
+// Reads the header of a log file, throws std::runtime_error if it is not one.
+void readLogHeader(std::istream &in);
+// Returns false at the end of the file.
+bool readLogRecord(std::istream &in, LogRecord &record);
+// One line of text for the record.
+std::string toText(LogRecord const &record);
+// The record as an event of a Chrome trace, without separator.
+std::string toChromeTrace(LogRecord const &record);
+
+// Adds a span from its construction to its destruction to the trace.
+class TraceScope {
+ private:
+  TraceScope(const TraceScope &) = delete;
+  TraceScope(TraceScope &&) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+  TraceScope &operator=(TraceScope &&) = delete;
+
+ public:
+  TraceScope(BinaryLog &log, TraceEvent event, int16_t frameId, float argument = 0.0f) noexcept;
+  ~TraceScope();
+
+ private:
+  BinaryLog &m_log;
+  TraceEvent const m_event;
+  int16_t const m_frameId;
+  float const m_argument;
+  int64_t const m_beginUs;
+};
+
+#endif
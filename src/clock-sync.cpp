@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clock-sync.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+// Below this many samples the slope is too noisy and the clocks are assumed
+// to run at the same rate.
+constexpr uint32_t kMinimumSamplesForDrift{64};
+// Crystal drift is tens of ppm, anything beyond this is a bad fit.
+constexpr double kMaximumDrift{1e-3};
+// The onboard clock jumping back by more than this means the Crazyflie
+// rebooted.
+constexpr int64_t kMaximumBackwardsMs{1000};
+}
+
+ClockSync::ClockSync(uint32_t windowSize)
+  : m_samples(std::max<uint32_t>(windowSize, 2))
+  , m_next(0)
+  , m_count(0)
+  , m_sumOnboard(0.0)
+  , m_sumHost(0.0)
+  , m_sumOnboardOnboard(0.0)
+  , m_sumOnboardHost(0.0)
+  , m_hasReference(false)
+  , m_lastOnboardMs(0)
+  , m_onboardUs(0)
+  , m_referenceHostUs(0)
+  , m_drift(1.0)
+{
+}
+
+void ClockSync::reset() noexcept
+{
+    m_next = 0;
+    m_count = 0;
+    m_sumOnboard = 0.0;
+    m_sumHost = 0.0;
+    m_sumOnboardOnboard = 0.0;
+    m_sumOnboardHost = 0.0;
+    m_hasReference = false;
+    m_drift = 1.0;
+}
+
+int64_t ClockSync::update(uint32_t onboardMs, int64_t hostUs) noexcept
+{
+    if ( m_hasReference ){
+        // Unsigned subtraction handles the wrap around after ~49 days
+        int64_t const deltaMs{static_cast<int32_t>(onboardMs - m_lastOnboardMs)};
+        if ( deltaMs < -kMaximumBackwardsMs ){
+            reset();
+        } else {
+            m_onboardUs += deltaMs * 1000;
+        }
+    }
+    if ( !m_hasReference ){
+        m_hasReference = true;
+        m_onboardUs = 0;
+        m_referenceHostUs = hostUs;
+    }
+    m_lastOnboardMs = onboardMs;
+
+    Sample const sample{static_cast<double>(m_onboardUs), static_cast<double>(hostUs - m_referenceHostUs)};
+    if ( m_count == m_samples.size() ){
+        Sample const &oldest = m_samples[m_next];
+        m_sumOnboard -= oldest.onboard;
+        m_sumHost -= oldest.host;
+        m_sumOnboardOnboard -= oldest.onboard * oldest.onboard;
+        m_sumOnboardHost -= oldest.onboard * oldest.host;
+    } else {
+        m_count++;
+    }
+    m_samples[m_next] = sample;
+    m_next = (m_next + 1) % static_cast<uint32_t>(m_samples.size());
+    m_sumOnboard += sample.onboard;
+    m_sumHost += sample.host;
+    m_sumOnboardOnboard += sample.onboard * sample.onboard;
+    m_sumOnboardHost += sample.onboard * sample.host;
+
+    m_drift = 1.0;
+    if ( m_count >= kMinimumSamplesForDrift ){
+        double const n{static_cast<double>(m_count)};
+        double const denominator{n * m_sumOnboardOnboard - m_sumOnboard * m_sumOnboard};
+        if ( denominator > 0.0 ){
+            double const slope{(n * m_sumOnboardHost - m_sumOnboard * m_sumHost) / denominator};
+            m_drift = std::min(std::max(slope, 1.0 - kMaximumDrift), 1.0 + kMaximumDrift);
+        }
+    }
+
+    double offset{std::numeric_limits<double>::max()};
+    for (uint32_t i{0}; i < m_count; i++) {
+        offset = std::min(offset, m_samples[i].host - m_drift * m_samples[i].onboard);
+    }
+
+    // Never later than the receive time, by construction of the envelope
+    return m_referenceHostUs + static_cast<int64_t>(offset + m_drift * sample.onboard);
+}
+
+double ClockSync::driftPpm() const noexcept
+{
+    return (m_drift - 1.0) * 1e6;
+}
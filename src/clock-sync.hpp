@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLOCK_SYNC_HPP
+#define CLOCK_SYNC_HPP
+
+#include <cstdint>
+#include <vector>
+
+// Online estimate of the mapping from the Crazyflie's millisecond clock to
+// host time, host = offset + drift * onboard. The drift is a least-squares
+// fit over a sliding window of (onboard, host receive) pairs. Radio and USB
+// delays only ever make a packet late, so the offset follows the lower
+// envelope of the window, i.e. the packets that were delayed the least.
+class ClockSync {
+ public:
+  explicit ClockSync(uint32_t windowSize);
+
+  // Adds a packet stamped onboard with onboardMs that was received at
+  // hostUs, returns the host time in microseconds at which it was sampled.
+  int64_t update(uint32_t onboardMs, int64_t hostUs) noexcept;
+  void reset() noexcept;
+
+  // Drift of the onboard clock relative to the host in parts per million.
+  double driftPpm() const noexcept;
+
+ private:
+  struct Sample {
+    double onboard;
+    double host;
+  };
+
+  std::vector<Sample> m_samples;
+  uint32_t m_next;
+  uint32_t m_count;
+  double m_sumOnboard;
+  double m_sumHost;
+  double m_sumOnboardOnboard;
+  double m_sumOnboardHost;
+
+  // Onboard time is unwrapped to 64 bit, both clocks are kept relative to
+  // the first sample so the sums stay precise.
+  bool m_hasReference;
+  uint32_t m_lastOnboardMs;
+  int64_t m_onboardUs;
+  int64_t m_referenceHostUs;
+  double m_drift;
+};
+
+#endif
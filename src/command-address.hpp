@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMAND_ADDRESS_HPP
+#define COMMAND_ADDRESS_HPP
+
+#include <cstdint>
+
+// The senderStamp of a CrazyFlieCommand says what kind of command it is
+// (0 takeoff, 1 land, 2 stop, 3 goTo, 4 hover, 5 position) and who it is
+// for, trajectories are started with a CrazyFlieTrajectory:
+//   bits  0..7   kind
+//   bits  8..23  target, depending on the scope
+//   bits 24..31  scope
+// A plain kind, as sent by older senders, is for every drone.
+enum class CommandScope : uint8_t {
+  All = 0,
+  // Target is a high-level commander group mask
+  Group = 1,
+  // Target is the frameId of one drone
+  Drone = 2
+};
+
+struct CommandAddress {
+  CommandScope scope;
+  uint16_t target;
+  uint8_t kind;
+};
+
+inline CommandAddress toCommandAddress(uint32_t senderStamp) noexcept {
+  return CommandAddress{static_cast<CommandScope>(senderStamp >> 24),
+    static_cast<uint16_t>((senderStamp >> 8) & 0xFFFF),
+    static_cast<uint8_t>(senderStamp & 0xFF)};
+}
+
+#endif
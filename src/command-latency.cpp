@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "command-latency.hpp"
+#include "opendlv-standard-message-set.hpp"
+
+#include <iostream>
+
+namespace {
+char const *const kStageNames[] = {"transport", "queue", "radio", "total"};
+}
+
+CommandLatency::CommandLatency()
+  : m_histograms()
+{
+}
+
+void CommandLatency::record(command const &cmd, int64_t sentUs) noexcept
+{
+    if ( cmd.Type < 0 || static_cast<uint32_t>(cmd.Type) >= kCommandTypeCount ){
+        return;
+    }
+    uint32_t const type{static_cast<uint32_t>(cmd.Type)};
+    LatencyHistogram *histograms{&m_histograms[type * kLatencyStageCount]};
+    histograms[static_cast<uint32_t>(LatencyStage::Transport)].record(cmd.receivedUs - cmd.issuedUs);
+    histograms[static_cast<uint32_t>(LatencyStage::Queue)].record(cmd.dequeuedUs - cmd.receivedUs);
+    histograms[static_cast<uint32_t>(LatencyStage::Radio)].record(sentUs - cmd.dequeuedUs);
+    histograms[static_cast<uint32_t>(LatencyStage::Total)].record(sentUs - cmd.issuedUs);
+}
+
+void CommandLatency::publish(MeteredOD4Session &od4, uint32_t senderStamp) const
+{
+    cluon::data::TimeStamp const now{cluon::time::now()};
+    for (uint32_t type{0}; type < kCommandTypeCount; type++) {
+        for (uint32_t stage{0}; stage < kLatencyStageCount; stage++) {
+            LatencyHistogram const &latency = histogram(type, static_cast<LatencyStage>(stage));
+            if ( 0 == latency.count() ){
+                continue;
+            }
+            opendlv::system::CrazyFlieCommandLatency message;
+            message.type(static_cast<int16_t>(type));
+            message.stage(static_cast<uint8_t>(stage));
+            message.count(latency.count());
+            message.mean(static_cast<uint32_t>(latency.mean()));
+            message.p50(static_cast<uint32_t>(latency.percentile(50.0)));
+            message.p90(static_cast<uint32_t>(latency.percentile(90.0)));
+            message.p99(static_cast<uint32_t>(latency.percentile(99.0)));
+            message.p999(static_cast<uint32_t>(latency.percentile(99.9)));
+            message.max(static_cast<uint32_t>(latency.max()));
+            od4.send(message, now, senderStamp);
+        }
+    }
+}
+
+void CommandLatency::printStatistics(std::string const &source) const
+{
+    for (uint32_t type{0}; type < kCommandTypeCount; type++) {
+        for (uint32_t stage{0}; stage < kLatencyStageCount; stage++) {
+            LatencyHistogram const &latency = histogram(type, static_cast<LatencyStage>(stage));
+            if ( 0 == latency.count() ){
+                continue;
+            }
+            std::cout << "Command type " << type << " " << kStageNames[stage] << " latency of " << source << ": " << latency.count() << " command(s), mean " << latency.mean() << " us, p50 " << latency.percentile(50.0) << " us, p90 " << latency.percentile(90.0) << " us, p99 " << latency.percentile(99.0) << " us, p99.9 " << latency.percentile(99.9) << " us, max " << latency.max() << " us." << std::endl;
+        }
+    }
+}
+
+LatencyHistogram const &CommandLatency::histogram(uint32_t type, LatencyStage stage) const noexcept
+{
+    return m_histograms[type * kLatencyStageCount + static_cast<uint32_t>(stage)];
+}
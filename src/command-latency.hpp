@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMAND_LATENCY_HPP
+#define COMMAND_LATENCY_HPP
+
+#include "cluon-complete.hpp"
+#include "command-queue.hpp"
+#include "latency-histogram.hpp"
+#include "metered-od4-session.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+// Parts of the way of a command from the planner to the radio.
+enum class LatencyStage : uint8_t {
+  // From the planner sending the message to it being received, only
+  // meaningful if both run on the same clock
+  Transport = 0,
+  // From being received to being taken from the queue by the radio thread
+  Queue = 1,
+  // From being taken from the queue until the radio is done sending it
+  Radio = 2,
+  // From the planner sending the message until the radio is done
+  Total = 3
+};
+constexpr uint32_t kLatencyStageCount{4};
+// Command types 0 to 7, see dispatch() of RadioLink
+constexpr uint32_t kCommandTypeCount{8};
+
+// Latency histograms per command type and stage. Commands are recorded
+// once the radio is done sending them, from the thread that sent them,
+// with the time stamps the command picked up on its way.
+class CommandLatency {
+ private:
+  CommandLatency(const CommandLatency &) = delete;
+  CommandLatency(CommandLatency &&) = delete;
+  CommandLatency &operator=(const CommandLatency &) = delete;
+  CommandLatency &operator=(CommandLatency &&) = delete;
+
+ public:
+  CommandLatency();
+
+  void record(command const &cmd, int64_t sentUs) noexcept;
+  // Sends a CrazyFlieCommandLatency for every type and stage seen so far.
+  void publish(MeteredOD4Session &od4, uint32_t senderStamp) const;
+  // source names whose commands these are, as in "frame 3".
+  void printStatistics(std::string const &source) const;
+
+ private:
+  LatencyHistogram const &histogram(uint32_t type, LatencyStage stage) const noexcept;
+
+  std::array<LatencyHistogram, kCommandTypeCount * kLatencyStageCount> m_histograms;
+};
+
+#endif
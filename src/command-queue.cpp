@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "command-queue.hpp"
+
+CommandQueue::CommandQueue(uint32_t capacity, WakeSignal &wakeSignal)
+  : m_cells()
+  , m_mask(0)
+  , m_onSuperseded()
+  , m_wakeSignal(wakeSignal)
+{
+  uint64_t size{2};
+  while (size < capacity) {
+    size <<= 1;
+  }
+  m_mask = size - 1;
+  m_cells.reset(new Cell[size]);
+  for (uint64_t i{0}; i < size; i++) {
+    m_cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+bool CommandQueue::push(const command &cmd) noexcept
+{
+  if (isEmergencyCommand(cmd)) {
+    lockSlots();
+    if (m_hasEmergency.load(std::memory_order_relaxed)) {
+      m_coalesced.fetch_add(1, std::memory_order_relaxed);
+      // The stop that is overtaken has to stop its groups as well
+      uint8_t const groupMask{(0 == m_emergency.groupMask || 0 == cmd.groupMask) ? uint8_t{0} : static_cast<uint8_t>(m_emergency.groupMask | cmd.groupMask)};
+      m_emergency = cmd;
+      m_emergency.groupMask = groupMask;
+    } else {
+      m_emergency = cmd;
+    }
+    m_emergencyOrder = m_order.fetch_add(1, std::memory_order_relaxed);
+    m_hasEmergency.store(true, std::memory_order_release);
+    unlockSlots();
+    m_wakeSignal.notify();
+    return true;
+  }
+  if (isSetpointCommand(cmd)) {
+    lockSlots();
+    if (m_hasSetpoint.load(std::memory_order_relaxed)) {
+      m_coalesced.fetch_add(1, std::memory_order_relaxed);
+    }
+    m_setpoint = cmd;
+    m_setpointOrder = m_order.fetch_add(1, std::memory_order_relaxed);
+    m_hasSetpoint.store(true, std::memory_order_release);
+    unlockSlots();
+    m_wakeSignal.notify();
+    return true;
+  }
+
+  // Claim a cell, see D. Vyukov's bounded MPMC queue.
+  Cell *cell{nullptr};
+  uint64_t pos{m_enqueuePos.load(std::memory_order_relaxed)};
+  for (;;) {
+    cell = &m_cells[pos & m_mask];
+    uint64_t const seq{cell->sequence.load(std::memory_order_acquire)};
+    int64_t const diff{static_cast<int64_t>(seq) - static_cast<int64_t>(pos)};
+    if (0 == diff) {
+      if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      pos = m_enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+  cell->cmd = cmd;
+  cell->order = m_order.fetch_add(1, std::memory_order_relaxed);
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  m_wakeSignal.notify();
+  return true;
+}
+
+bool CommandQueue::popEmergency(command &cmd) noexcept
+{
+  if (!m_hasEmergency.load(std::memory_order_acquire)) {
+    return false;
+  }
+  lockSlots();
+  cmd = m_emergency;
+  m_hasEmergency.store(false, std::memory_order_relaxed);
+  m_discardBefore = m_emergencyOrder;
+  m_discardMask = m_emergency.groupMask;
+  // A setpoint from before the stop must not spin the motors up again
+  if (m_hasSetpoint.load(std::memory_order_relaxed) && m_setpointOrder < m_discardBefore
+      && isCoveredBy(m_setpoint.groupMask, m_discardMask)) {
+    m_hasSetpoint.store(false, std::memory_order_relaxed);
+    m_superseded.fetch_add(1, std::memory_order_relaxed);
+  }
+  unlockSlots();
+  return true;
+}
+
+bool CommandQueue::pop(command &cmd) noexcept
+{
+  if (popEmergency(cmd)) {
+    return true;
+  }
+  discardSuperseded();
+
+  uint64_t queuedOrder{0};
+  bool const hasQueued{peekOrder(queuedOrder)};
+  if (m_hasSetpoint.load(std::memory_order_acquire)) {
+    lockSlots();
+    // Only hand out the setpoint if it arrived before the next discrete command.
+    if (!hasQueued || m_setpointOrder < queuedOrder) {
+      cmd = m_setpoint;
+      m_hasSetpoint.store(false, std::memory_order_relaxed);
+      unlockSlots();
+      return true;
+    }
+    unlockSlots();
+  }
+  if (!hasQueued) {
+    return false;
+  }
+
+  uint64_t const pos{m_dequeuePos.load(std::memory_order_relaxed)};
+  Cell &cell = m_cells[pos & m_mask];
+  cmd = cell.cmd;
+  cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+  m_dequeuePos.store(pos + 1, std::memory_order_relaxed);
+  return true;
+}
+
+bool CommandQueue::hasEmergency() const noexcept
+{
+  return m_hasEmergency.load(std::memory_order_acquire);
+}
+
+bool CommandQueue::empty() const noexcept
+{
+  uint64_t order{0};
+  return !m_hasEmergency.load(std::memory_order_acquire)
+    && !m_hasSetpoint.load(std::memory_order_acquire) && !peekOrder(order);
+}
+
+bool CommandQueue::isSetpointNext() const noexcept
+{
+  if (m_hasEmergency.load(std::memory_order_acquire) || !m_hasSetpoint.load(std::memory_order_acquire)) {
+    return false;
+  }
+  uint64_t queuedOrder{0};
+  if (!peekOrder(queuedOrder)) {
+    return true;
+  }
+  lockSlots();
+  bool const isNext{m_setpointOrder < queuedOrder};
+  unlockSlots();
+  return isNext;
+}
+
+uint32_t CommandQueue::depth() const noexcept
+{
+  uint64_t const queued{m_enqueuePos.load(std::memory_order_relaxed) - m_dequeuePos.load(std::memory_order_relaxed)};
+  return static_cast<uint32_t>(queued) + (m_hasSetpoint.load(std::memory_order_relaxed) ? 1 : 0)
+    + (m_hasEmergency.load(std::memory_order_relaxed) ? 1 : 0);
+}
+
+uint64_t CommandQueue::dropped() const noexcept
+{
+  return m_dropped.load(std::memory_order_relaxed);
+}
+
+uint64_t CommandQueue::coalesced() const noexcept
+{
+  return m_coalesced.load(std::memory_order_relaxed);
+}
+
+uint64_t CommandQueue::superseded() const noexcept
+{
+  return m_superseded.load(std::memory_order_relaxed);
+}
+
+void CommandQueue::onSuperseded(std::function<void(const command &)> handler)
+{
+  m_onSuperseded = handler;
+}
+
+bool CommandQueue::peekOrder(uint64_t &order) const noexcept
+{
+  uint64_t const pos{m_dequeuePos.load(std::memory_order_relaxed)};
+  Cell const &cell = m_cells[pos & m_mask];
+  if (cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+    return false;
+  }
+  order = cell.order;
+  return true;
+}
+
+void CommandQueue::discardSuperseded() noexcept
+{
+  uint64_t order{0};
+  while (peekOrder(order) && order < m_discardBefore) {
+    uint64_t const pos{m_dequeuePos.load(std::memory_order_relaxed)};
+    if (!isCoveredBy(m_cells[pos & m_mask].cmd.groupMask, m_discardMask)) {
+      break;
+    }
+    command const superseded{m_cells[pos & m_mask].cmd};
+    m_cells[pos & m_mask].sequence.store(pos + m_mask + 1, std::memory_order_release);
+    m_dequeuePos.store(pos + 1, std::memory_order_relaxed);
+    m_superseded.fetch_add(1, std::memory_order_relaxed);
+    if (m_onSuperseded) {
+      m_onSuperseded(superseded);
+    }
+  }
+}
+
+void CommandQueue::lockSlots() const noexcept
+{
+  while (m_slotLock.test_and_set(std::memory_order_acquire)) {
+  }
+}
+
+void CommandQueue::unlockSlots() const noexcept
+{
+  m_slotLock.clear(std::memory_order_release);
+}
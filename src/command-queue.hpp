@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMAND_QUEUE_HPP
+#define COMMAND_QUEUE_HPP
+
+#include "wake-signal.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+struct command {
+  float x;
+  float y;
+  float z;
+  float yaw;
+  float vx;
+  float vy;
+  float yawRate;
+  float height;
+  float time;
+  // Full-state setpoints only
+  float vz;
+  float ax;
+  float ay;
+  float az;
+  float qx;
+  float qy;
+  float qz;
+  float qw;
+  float rollRate;
+  float pitchRate;
+  // Starting a trajectory only
+  uint8_t trajectoryId;
+  float timescale;
+  bool relative;
+  bool reversed;
+  int16_t Type;
+  // High-level commander groups the command is for, 0 for all
+  uint8_t groupMask;
+  // senderStamp of the command message, its sent time stamp, the time it
+  // was received and the time it was taken from the queue, in microseconds,
+  // for reporting its status and latency
+  uint32_t senderStamp;
+  int64_t issuedUs;
+  int64_t receivedUs;
+  int64_t dequeuedUs;
+} __attribute__((packed));
+
+// Whether a stop for stopMask also stops everyone a command for groupMask is for.
+inline bool isCoveredBy(uint8_t groupMask, uint8_t stopMask) noexcept {
+  return stopMask == 0 || (groupMask != 0 && (groupMask & ~stopMask) == 0);
+}
+
+// A stop cuts the motors and jumps ahead of everything else.
+inline bool isEmergencyCommand(const command &cmd) noexcept {
+  return cmd.Type == 2;
+}
+
+// Takeoff, land and stop are sent again if they are not acknowledged.
+inline bool isCriticalCommand(const command &cmd) noexcept {
+  return cmd.Type == 0 || cmd.Type == 1 || cmd.Type == 2;
+}
+
+// Setpoints are only meaningful as "the latest one", so they are coalesced
+// instead of being queued behind each other.
+inline bool isSetpointCommand(const command &cmd) noexcept {
+  return cmd.Type == 4 || cmd.Type == 5 || cmd.Type == 6;
+}
+
+// Bounded multi-producer/single-consumer queue between the OD4 receive
+// thread(s) and the radio thread. Discrete commands (takeoff, land, stop,
+// goTo) are kept in order in a lock-free ring buffer, setpoints are coalesced
+// into a single slot. Both are handed out in arrival order. An emergency
+// stop is handed out ahead of them and supersedes whatever arrived before
+// it for the same groups. The consumer is woken up through a WakeSignal that can be shared
+// between queues.
+class CommandQueue {
+ private:
+  CommandQueue(const CommandQueue &) = delete;
+  CommandQueue(CommandQueue &&) = delete;
+  CommandQueue &operator=(const CommandQueue &) = delete;
+  CommandQueue &operator=(CommandQueue &&) = delete;
+
+ public:
+  // The capacity is rounded up to the next power of two.
+  CommandQueue(uint32_t capacity, WakeSignal &wakeSignal);
+
+  // Returns false if the command had to be dropped because the ring is full.
+  bool push(const command &cmd) noexcept;
+  // Must only be called from the consumer thread.
+  bool popEmergency(command &cmd) noexcept;
+  // Must only be called from the consumer thread.
+  bool pop(command &cmd) noexcept;
+  bool hasEmergency() const noexcept;
+  bool empty() const noexcept;
+  // Whether pop() would hand out the setpoint. Consumer thread only.
+  bool isSetpointNext() const noexcept;
+
+  uint32_t depth() const noexcept;
+  uint64_t dropped() const noexcept;
+  uint64_t coalesced() const noexcept;
+  // Commands that were still queued when an emergency stop overtook them.
+  uint64_t superseded() const noexcept;
+  // Called from the consumer thread with every discrete command that was
+  // superseded, must be set before the queue is used.
+  void onSuperseded(std::function<void(const command &)> handler);
+
+ private:
+  struct Cell {
+    std::atomic<uint64_t> sequence{0};
+    uint64_t order{0};
+    command cmd{};
+  };
+
+  bool peekOrder(uint64_t &order) const noexcept;
+  void discardSuperseded() noexcept;
+  void lockSlots() const noexcept;
+  void unlockSlots() const noexcept;
+
+  std::unique_ptr<Cell[]> m_cells;
+  uint64_t m_mask;
+  std::atomic<uint64_t> m_enqueuePos{0};
+  std::atomic<uint64_t> m_dequeuePos{0};
+  std::atomic<uint64_t> m_order{0};
+
+  // Guards the setpoint and emergency slots
+  mutable std::atomic_flag m_slotLock = ATOMIC_FLAG_INIT;
+  std::atomic<bool> m_hasSetpoint{false};
+  command m_setpoint{};
+  uint64_t m_setpointOrder{0};
+  std::atomic<bool> m_hasEmergency{false};
+  command m_emergency{};
+  uint64_t m_emergencyOrder{0};
+  // Consumer side only, everything older than the last emergency stop and
+  // meant for the groups it stopped
+  uint64_t m_discardBefore{0};
+  uint8_t m_discardMask{0};
+
+  std::atomic<uint64_t> m_dropped{0};
+  std::atomic<uint64_t> m_coalesced{0};
+  std::atomic<uint64_t> m_superseded{0};
+  std::function<void(const command &)> m_onSuperseded;
+
+  WakeSignal &m_wakeSignal;
+};
+
+#endif
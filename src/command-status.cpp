@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "command-status.hpp"
+#include "opendlv-standard-message-set.hpp"
+
+void reportCommandStatus(MeteredOD4Session &od4, command const &cmd,
+    int16_t frameId, CommandState state, uint32_t attempt)
+{
+    if ( isSetpointCommand(cmd) ){
+        return;
+    }
+    cluon::data::TimeStamp const now{cluon::time::now()};
+    opendlv::system::CrazyFlieCommandStatus status;
+    status.commandTime(cmd.issuedUs);
+    status.type(cmd.Type);
+    status.frameId(frameId);
+    status.state(static_cast<uint8_t>(state));
+    status.attempt(attempt);
+    status.latency(static_cast<uint32_t>(cluon::time::toMicroseconds(now) - cmd.receivedUs));
+    od4.send(status, now, cmd.senderStamp);
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMAND_STATUS_HPP
+#define COMMAND_STATUS_HPP
+
+#include "cluon-complete.hpp"
+#include "command-queue.hpp"
+#include "metered-od4-session.hpp"
+
+#include <cstdint>
+
+enum class CommandState : uint8_t {
+  // Accepted into the queue of a drone or the broadcast queue
+  Queued = 0,
+  // Handed to the radio
+  Sent = 1,
+  // Acknowledged by the Crazyflie, broadcasts are never acknowledged
+  Acked = 2,
+  // Dropped, superseded by a stop, or still not acknowledged after the
+  // last attempt
+  Failed = 3
+};
+
+// frameId of the status of a broadcast command.
+constexpr int16_t kBroadcastFrameId{-1};
+
+// Publishes the progress of a command as CrazyFlieCommandStatus with the
+// senderStamp the command came with. Setpoints are superseded too quickly
+// to be worth reporting and are left out.
+void reportCommandStatus(MeteredOD4Session &od4, command const &cmd,
+    int16_t frameId, CommandState state, uint32_t attempt);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "binary-log.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// Prints a binary log written with --binary-log as text, one record per line,
+// or with --chrome-trace as a Chrome trace for chrome://tracing or Perfetto.
+int32_t main(int32_t argc, char **argv) {
+    bool const isChromeTrace{argc == 3 && std::string(argv[1]) == "--chrome-trace"};
+    if ( argc != 2 && !isChromeTrace ) {
+        std::cerr << "Usage: " << argv[0] << " [--chrome-trace] <binary log>" << std::endl;
+        return 1;
+    }
+    char const *filename{argv[argc - 1]};
+    std::ifstream in(filename, std::ios::binary);
+    if ( !in.good() ) {
+        std::cerr << "Could not open " << filename << std::endl;
+        return 1;
+    }
+    try{
+        readLogHeader(in);
+    }
+    catch(std::exception& e){
+        std::cerr << filename << ": " << e.what() << std::endl;
+        return 1;
+    }
+    LogRecord record;
+    if ( isChromeTrace ) {
+        char const *separator{"\n"};
+        std::cout << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        while (readLogRecord(in, record)) {
+            std::cout << separator << toChromeTrace(record);
+            separator = ",\n";
+        }
+        std::cout << "\n]}" << std::endl;
+        return 0;
+    }
+    while (readLogRecord(in, record)) {
+        std::cout << toText(record) << '\n';
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "latency-histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+LatencyHistogram::LatencyHistogram()
+  : m_counts()
+  , m_count(0)
+  , m_sum(0)
+  , m_max(0)
+{
+    for (auto &count : m_counts) {
+        count = 0;
+    }
+}
+
+void LatencyHistogram::record(int64_t valueUs) noexcept
+{
+    uint64_t const value{static_cast<uint64_t>(std::max<int64_t>(0, valueUs))};
+    m_counts[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t max{m_max.load(std::memory_order_relaxed)};
+    while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+    m_count.fetch_add(1, std::memory_order_release);
+}
+
+uint64_t LatencyHistogram::count() const noexcept
+{
+    return m_count.load(std::memory_order_acquire);
+}
+
+int64_t LatencyHistogram::mean() const noexcept
+{
+    uint64_t const count{m_count.load(std::memory_order_acquire)};
+    return (count > 0) ? static_cast<int64_t>(m_sum.load(std::memory_order_relaxed) / count) : 0;
+}
+
+int64_t LatencyHistogram::max() const noexcept
+{
+    return static_cast<int64_t>(m_max.load(std::memory_order_relaxed));
+}
+
+int64_t LatencyHistogram::percentile(double percentile) const noexcept
+{
+    // Counts recorded meanwhile may be missing from the total, or be in the
+    // buckets already, which only moves the result by a bucket
+    uint64_t const count{m_count.load(std::memory_order_acquire)};
+    if ( 0 == count ){
+        return 0;
+    }
+    uint64_t const rank{std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(std::min(100.0, std::max(0.0, percentile)) / 100.0 * static_cast<double>(count))))};
+    uint64_t seen{0};
+    for (uint32_t bucket{0}; bucket < kBucketCount; bucket++) {
+        seen += m_counts[bucket].load(std::memory_order_relaxed);
+        if ( seen >= rank ){
+            return std::min(static_cast<int64_t>(highestValueOf(bucket)), max());
+        }
+    }
+    return max();
+}
+
+uint32_t LatencyHistogram::bucketOf(uint64_t value) noexcept
+{
+    if ( value < 2 * kSubBuckets ){
+        return static_cast<uint32_t>(value);
+    }
+    // The five bits below the highest one pick the bucket within its power
+    // of two
+    uint32_t exponent{0};
+    for (uint64_t v{value}; v > 1; v >>= 1) {
+        exponent++;
+    }
+    uint32_t const shift{exponent - 5};
+    uint32_t const bucket{2 * kSubBuckets + (exponent - 6) * kSubBuckets + static_cast<uint32_t>(value >> shift) - kSubBuckets};
+    return std::min(bucket, kBucketCount - 1);
+}
+
+uint64_t LatencyHistogram::highestValueOf(uint32_t bucket) noexcept
+{
+    if ( bucket < 2 * kSubBuckets ){
+        return bucket;
+    }
+    uint32_t const exponent{6 + (bucket - 2 * kSubBuckets) / kSubBuckets};
+    uint64_t const subBucket{kSubBuckets + (bucket - 2 * kSubBuckets) % kSubBuckets};
+    return ((subBucket + 1) << (exponent - 5)) - 1;
+}
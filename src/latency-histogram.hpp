@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Histogram of latencies in microseconds with a bounded relative error, laid
+// out like HdrHistogram: values below 64 us get a bucket each, above that
+// every power of two is split into 32 buckets, which keeps the error below
+// 3.2% up to 2^32 us. Larger values are counted in the last bucket. Values
+// are recorded lock-free and may come from any thread.
+class LatencyHistogram {
+ private:
+  LatencyHistogram(const LatencyHistogram &) = delete;
+  LatencyHistogram(LatencyHistogram &&) = delete;
+  LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+  LatencyHistogram &operator=(LatencyHistogram &&) = delete;
+
+ public:
+  LatencyHistogram();
+
+  // Negative values, as from clocks that are not in sync, count as zero.
+  void record(int64_t valueUs) noexcept;
+
+  uint64_t count() const noexcept;
+  int64_t mean() const noexcept;
+  int64_t max() const noexcept;
+  // The highest value that is counted the same as the one at the given
+  // percentile, 0 to 100.
+  int64_t percentile(double percentile) const noexcept;
+
+ private:
+  static constexpr uint32_t kSubBuckets{32};
+  static constexpr uint32_t kBucketCount{2 * kSubBuckets + 26 * kSubBuckets};
+
+  static uint32_t bucketOf(uint64_t value) noexcept;
+  static uint64_t highestValueOf(uint32_t bucket) noexcept;
+
+  std::array<std::atomic<uint64_t>, kBucketCount> m_counts;
+  std::atomic<uint64_t> m_count;
+  std::atomic<uint64_t> m_sum;
+  std::atomic<uint64_t> m_max;
+};
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "log-layout.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+// The fastest the Crazyflie logs, one packet per 10 ms period.
+constexpr float kMaxLogRate{100.0f};
+
+// The slowest period that still gives at least the requested rate.
+uint8_t toLogPeriod(float rate)
+{
+    return static_cast<uint8_t>(std::min(255.0f, std::max(1.0f, std::floor(kMaxLogRate / rate))));
+}
+
+LogGroup makeVariableGroup(std::string const &variable, float rate)
+{
+    if ( variable.find('.') == std::string::npos || rate <= 0.0f ){
+        throw std::runtime_error("Invalid log variable '" + variable + "', expected group.name with a positive rate");
+    }
+    return LogGroup{variable, {variable}, rate};
+}
+}
+
+std::vector<LogGroup> defaultLogGroups(bool compressed, float poseRate,
+    float batteryRate, float kinematicRate)
+{
+    std::vector<LogGroup> groups;
+    if ( poseRate > 0.0f ){
+        if ( compressed ){
+            groups.push_back(LogGroup{"pose", {"stateEstimateZ.x", "stateEstimateZ.y", "stateEstimateZ.z", "stateEstimateZ.quat"}, poseRate});
+        } else {
+            groups.push_back(LogGroup{"pose", {"stateEstimate.x", "stateEstimate.y", "stateEstimate.z", "stateEstimate.pitch", "stateEstimate.yaw"}, poseRate});
+        }
+    }
+    if ( kinematicRate > 0.0f ){
+        if ( compressed ){
+            groups.push_back(LogGroup{"kinematic", {"stateEstimateZ.vx", "stateEstimateZ.vy", "stateEstimateZ.vz", "stateEstimateZ.rateRoll", "stateEstimateZ.ratePitch", "stateEstimateZ.rateYaw"}, kinematicRate});
+        } else {
+            groups.push_back(LogGroup{"kinematic", {"stateEstimate.vx", "stateEstimate.vy", "stateEstimate.vz", "gyro.x", "gyro.y", "gyro.z"}, kinematicRate});
+        }
+    }
+    if ( batteryRate > 0.0f ){
+        groups.push_back(LogGroup{"battery", {"pm.vbat"}, batteryRate});
+    }
+    return groups;
+}
+
+std::vector<LogGroup> parseLogGroups(std::string const &list)
+{
+    std::vector<LogGroup> groups;
+    std::stringstream stream(list);
+    std::string entry;
+    while (std::getline(stream, entry, ',')) {
+        if ( entry.empty() ){
+            continue;
+        }
+        std::string::size_type const at{entry.find('@')};
+        if ( at == std::string::npos ){
+            throw std::runtime_error("Invalid log entry '" + entry + "', expected group.name@rate");
+        }
+        groups.push_back(makeVariableGroup(entry.substr(0, at), std::stof(entry.substr(at + 1))));
+    }
+    return groups;
+}
+
+std::vector<LogGroup> readLogGroups(std::string const &filename)
+{
+    std::ifstream file(filename);
+    if ( !file.good() ){
+        throw std::runtime_error("Could not open log configuration " + filename);
+    }
+    std::vector<LogGroup> groups;
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        std::stringstream stream(line);
+        std::string variable;
+        float rate{0.0f};
+        if ( !(stream >> variable) ){
+            continue;
+        }
+        if ( !(stream >> rate) ){
+            throw std::runtime_error("Missing rate for log variable " + variable + " in " + filename);
+        }
+        groups.push_back(makeVariableGroup(variable, rate));
+    }
+    return groups;
+}
+
+std::vector<LogGroup> mergeLogGroups(std::vector<LogGroup> groups,
+    std::vector<LogGroup> const &additional)
+{
+    for (auto const &group : additional) {
+        bool isMerged{false};
+        for (auto &existing : groups) {
+            if ( std::find(existing.variables.begin(), existing.variables.end(), group.variables.front()) != existing.variables.end() ){
+                existing.rate = std::max(existing.rate, group.rate);
+                isMerged = true;
+            }
+        }
+        if ( !isMerged ){
+            groups.push_back(group);
+        }
+    }
+    return groups;
+}
+
+std::vector<LogBlockLayout> packLogBlocks(std::vector<LogGroup> const &groups,
+    std::map<std::string, uint32_t> const &sizes)
+{
+    struct Item {
+      uint8_t period;
+      uint32_t size;
+      std::vector<std::string> variables;
+    };
+
+    std::vector<Item> items;
+    for (auto const &group : groups) {
+        if ( group.rate > kMaxLogRate ){
+            std::cerr << "Log group " << group.name << " asks for " << group.rate << " Hz, it is logged at the maximum of " << kMaxLogRate << " Hz." << std::endl;
+        }
+        Item item{toLogPeriod(group.rate), 0, {}};
+        for (auto const &variable : group.variables) {
+            auto const size = sizes.find(variable);
+            if ( size == sizes.end() ){
+                throw std::runtime_error("Log variable " + variable + " is not in the log TOC");
+            }
+            item.size += size->second;
+        }
+        if ( item.size <= kLogBlockPayload ){
+            item.variables = group.variables;
+            items.push_back(item);
+        } else {
+            // Too big for one packet, the variables have to be sampled apart
+            std::cerr << "Log group " << group.name << " does not fit into one log block, splitting it." << std::endl;
+            for (auto const &variable : group.variables) {
+                items.push_back(Item{item.period, sizes.at(variable), {variable}});
+            }
+        }
+    }
+
+    // Fastest first, within a rate the biggest first
+    std::stable_sort(items.begin(), items.end(), [](Item const &a, Item const &b) {
+        return (a.period != b.period) ? (a.period < b.period) : (a.size > b.size);
+    });
+
+    std::vector<LogBlockLayout> blocks;
+    for (auto const &item : items) {
+        // Only a block of the same period, the messages of a variable go out
+        // with every packet of its block. Take the tightest fit to keep room
+        // for the bigger ones.
+        LogBlockLayout *best{nullptr};
+        for (auto &block : blocks) {
+            if ( block.period == item.period && block.size + item.size <= kLogBlockPayload
+                && (nullptr == best || block.size > best->size) ){
+                best = &block;
+            }
+        }
+        if ( nullptr == best ){
+            blocks.push_back(LogBlockLayout{item.period, 0, {}});
+            best = &blocks.back();
+        }
+        best->size += item.size;
+        best->variables.insert(best->variables.end(), item.variables.begin(), item.variables.end());
+    }
+
+    if ( blocks.size() > kMaxLogBlocks ){
+        throw std::runtime_error("The log configuration needs " + std::to_string(blocks.size()) + " log blocks, the Crazyflie supports " + std::to_string(kMaxLogBlocks));
+    }
+    return blocks;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOG_LAYOUT_HPP
+#define LOG_LAYOUT_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// A CRTP packet carries 30 bytes, a log data packet spends one on the block
+// id and three on the timestamp.
+constexpr uint32_t kLogBlockPayload{26};
+// LOG_MAX_BLOCKS in the Crazyflie firmware.
+constexpr uint32_t kMaxLogBlocks{16};
+
+// Log variables ("group.name") that are wanted at a rate of at least rate
+// Hz. Variables of one group always end up in the same log block so that
+// they are sampled together.
+struct LogGroup {
+  std::string name;
+  std::vector<std::string> variables;
+  float rate;
+};
+
+struct LogBlockLayout {
+  // In units of 10 ms, as used by LogBlock::start
+  uint8_t period;
+  uint32_t size;
+  std::vector<std::string> variables;
+};
+
+// The groups behind Frame, CrazyFlieState and KinematicState, a rate of
+// zero leaves a group out.
+std::vector<LogGroup> defaultLogGroups(bool compressed, float poseRate,
+    float batteryRate, float kinematicRate);
+
+// Parses "group.name@rate,group.name@rate", one group per variable.
+std::vector<LogGroup> parseLogGroups(std::string const &list);
+// Reads one "group.name rate" per line, '#' starts a comment.
+std::vector<LogGroup> readLogGroups(std::string const &filename);
+// Joins the groups, a variable listed twice keeps the higher rate.
+std::vector<LogGroup> mergeLogGroups(std::vector<LogGroup> groups,
+    std::vector<LogGroup> const &additional);
+
+// Packs the groups into as few log blocks as the payload limit allows while
+// every group keeps its own rate: groups of the same period share blocks,
+// biggest first, and a group only gets a block of its own when none of its
+// period has room. This is not the fewest packets per second, a slow group
+// riding along in a faster block would cost none, but it would then be
+// sampled and published at the faster rate. Rates above 100 Hz are logged
+// at 100 Hz with a warning. sizes maps every variable to its size in bytes
+// as given by the log TOC. Throws std::runtime_error if the layout is not
+// possible.
+std::vector<LogBlockLayout> packLogBlocks(std::vector<LogGroup> const &groups,
+    std::map<std::string, uint32_t> const &sizes);
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "metered-od4-session.hpp"
+
+MeteredOD4Session::MeteredOD4Session(uint16_t cid, BinaryLog &log)
+  : cluon::OD4Session(cid)
+  , m_log(log)
+  , m_countsMutex()
+  , m_sent()
+  , m_received()
+{
+}
+
+bool MeteredOD4Session::dataTrigger(int32_t messageIdentifier, std::function<void(cluon::data::Envelope &&envelope)> delegate) noexcept
+{
+    return cluon::OD4Session::dataTrigger(messageIdentifier, [this, messageIdentifier, delegate](cluon::data::Envelope &&envelope) {
+        m_log.nameThread(ThreadRole::Od4);
+        count(m_received, messageIdentifier);
+        delegate(std::move(envelope));
+    });
+}
+
+std::map<int32_t, uint64_t> MeteredOD4Session::sent() const
+{
+    std::lock_guard<std::mutex> lck(m_countsMutex);
+    return m_sent;
+}
+
+std::map<int32_t, uint64_t> MeteredOD4Session::received() const
+{
+    std::lock_guard<std::mutex> lck(m_countsMutex);
+    return m_received;
+}
+
+void MeteredOD4Session::count(std::map<int32_t, uint64_t> &counts, int32_t messageIdentifier) noexcept
+{
+    std::lock_guard<std::mutex> lck(m_countsMutex);
+    counts[messageIdentifier]++;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef METERED_OD4_SESSION_HPP
+#define METERED_OD4_SESSION_HPP
+
+#include "cluon-complete.hpp"
+#include "binary-log.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+
+// OD4Session that counts the messages sent and received per message ID.
+// Only messages sent through this class and received through delegates
+// registered with its dataTrigger are counted. Sending is traced to log, the
+// threads running the delegates are named as OD4 threads.
+class MeteredOD4Session : public cluon::OD4Session {
+ private:
+  MeteredOD4Session(const MeteredOD4Session &) = delete;
+  MeteredOD4Session(MeteredOD4Session &&) = delete;
+  MeteredOD4Session &operator=(const MeteredOD4Session &) = delete;
+  MeteredOD4Session &operator=(MeteredOD4Session &&) = delete;
+
+ public:
+  MeteredOD4Session(uint16_t cid, BinaryLog &log);
+
+  template <typename T>
+  void send(T &message, const cluon::data::TimeStamp &sampleTimeStamp = cluon::data::TimeStamp(), uint32_t senderStamp = 0) noexcept {
+    TraceScope trace(m_log, TraceEvent::Od4Send, kNoFrameId, static_cast<float>(T::ID()));
+    count(m_sent, T::ID());
+    cluon::OD4Session::send(message, sampleTimeStamp, senderStamp);
+  }
+  bool dataTrigger(int32_t messageIdentifier, std::function<void(cluon::data::Envelope &&envelope)> delegate) noexcept;
+
+  std::map<int32_t, uint64_t> sent() const;
+  std::map<int32_t, uint64_t> received() const;
+
+ private:
+  void count(std::map<int32_t, uint64_t> &counts, int32_t messageIdentifier) noexcept;
+
+  // Sending is not tied to a Crazyflie
+  static constexpr int16_t kNoFrameId{-1};
+
+  BinaryLog &m_log;
+  mutable std::mutex m_countsMutex;
+  std::map<int32_t, uint64_t> m_sent;
+  std::map<int32_t, uint64_t> m_received;
+};
+
+#endif
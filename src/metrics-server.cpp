@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "metrics-server.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+MetricsText::MetricsText()
+  : m_text()
+{
+    // Counters stay exact up to 10^15
+    m_text.precision(15);
+}
+
+void MetricsText::family(std::string const &name, std::string const &type, std::string const &help)
+{
+    m_text << "# HELP " << name << " " << help << "\n";
+    m_text << "# TYPE " << name << " " << type << "\n";
+}
+
+void MetricsText::sample(std::string const &name, std::string const &labels, double value)
+{
+    m_text << name;
+    if ( !labels.empty() ){
+        m_text << "{" << labels << "}";
+    }
+    m_text << " " << value << "\n";
+}
+
+std::string MetricsText::str() const
+{
+    return m_text.str();
+}
+
+MetricsServer::MetricsServer(std::function<std::string()> collect)
+  : m_collect(collect)
+  , m_socket(-1)
+  , m_path()
+  , m_running(false)
+  , m_thread()
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+void MetricsServer::listenTcp(uint16_t port)
+{
+    m_socket = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ( m_socket < 0 ){
+        throw std::runtime_error(std::string("Could not create the metrics socket: ") + std::strerror(errno));
+    }
+    int const reuse{1};
+    ::setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    // Only reachable from this host
+    struct sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ( ::bind(m_socket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0 || ::listen(m_socket, 4) != 0 ){
+        int const error{errno};
+        close(m_socket);
+        m_socket = -1;
+        throw std::runtime_error("Could not listen for metrics on port " + std::to_string(port) + ": " + std::strerror(error));
+    }
+    m_running = true;
+    m_thread = std::thread(&MetricsServer::run, this);
+}
+
+void MetricsServer::listenUnix(std::string const &path)
+{
+    struct sockaddr_un address{};
+    if ( path.size() >= sizeof(address.sun_path) ){
+        throw std::runtime_error("Metrics socket path " + path + " is too long");
+    }
+    m_socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ( m_socket < 0 ){
+        throw std::runtime_error(std::string("Could not create the metrics socket: ") + std::strerror(errno));
+    }
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    // A socket left behind by an earlier run would fail the bind
+    ::unlink(path.c_str());
+    if ( ::bind(m_socket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0 || ::listen(m_socket, 4) != 0 ){
+        int const error{errno};
+        close(m_socket);
+        m_socket = -1;
+        throw std::runtime_error("Could not listen for metrics on " + path + ": " + std::strerror(error));
+    }
+    m_path = path;
+    m_running = true;
+    m_thread = std::thread(&MetricsServer::run, this);
+}
+
+void MetricsServer::stop()
+{
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    if ( m_socket >= 0 ){
+        close(m_socket);
+        m_socket = -1;
+    }
+    if ( !m_path.empty() ){
+        ::unlink(m_path.c_str());
+        m_path.clear();
+    }
+}
+
+void MetricsServer::run()
+{
+    struct pollfd listening{m_socket, POLLIN, 0};
+    while (m_running) {
+        // Wake up now and then to notice stop()
+        if ( poll(&listening, 1, 100) <= 0 ){
+            continue;
+        }
+        int const client{::accept4(m_socket, nullptr, nullptr, SOCK_CLOEXEC)};
+        if ( client < 0 ){
+            continue;
+        }
+        serve(client);
+        close(client);
+    }
+}
+
+void MetricsServer::serve(int client)
+{
+    // Whatever is asked for, the answer is the metrics page. The request is
+    // read up to its end so that the client does not see a reset.
+    std::string request;
+    struct pollfd connection{client, POLLIN, 0};
+    while (request.find("\r\n\r\n") == std::string::npos && request.find("\n\n") == std::string::npos && request.size() < 8192) {
+        if ( poll(&connection, 1, 1000) <= 0 ){
+            return;
+        }
+        char buffer[1024];
+        ssize_t const received{::recv(client, buffer, sizeof(buffer), 0)};
+        if ( received <= 0 ){
+            return;
+        }
+        request.append(buffer, static_cast<size_t>(received));
+    }
+
+    std::string const body{m_collect()};
+    std::string const response{"HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body};
+    for (size_t sent{0}; sent < response.size(); ) {
+        ssize_t const written{::send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL)};
+        if ( written <= 0 ){
+            return;
+        }
+        sent += static_cast<size_t>(written);
+    }
+}
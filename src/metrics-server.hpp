@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef METRICS_SERVER_HPP
+#define METRICS_SERVER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+
+// Builds a page in the Prometheus text exposition format.
+class MetricsText {
+ public:
+  MetricsText();
+
+  // Starts a metric family, type is counter, gauge or summary.
+  void family(std::string const &name, std::string const &type, std::string const &help);
+  // Labels as 'frame="1",class="emergency"', empty for none.
+  void sample(std::string const &name, std::string const &labels, double value);
+  std::string str() const;
+
+ private:
+  std::ostringstream m_text;
+};
+
+// Serves the metrics of the bridge over HTTP on a TCP port of the loopback
+// interface, or on a Unix socket, so that a Prometheus agent next to the
+// bridge can scrape it. Every request is answered with the page collect
+// returns, one request at a time from a thread of its own.
+class MetricsServer {
+ private:
+  MetricsServer(const MetricsServer &) = delete;
+  MetricsServer(MetricsServer &&) = delete;
+  MetricsServer &operator=(const MetricsServer &) = delete;
+  MetricsServer &operator=(MetricsServer &&) = delete;
+
+ public:
+  explicit MetricsServer(std::function<std::string()> collect);
+  ~MetricsServer();
+
+  // Either one throws std::runtime_error if the socket cannot be set up.
+  void listenTcp(uint16_t port);
+  void listenUnix(std::string const &path);
+  void stop();
+
+ private:
+  void run();
+  void serve(int client);
+
+  std::function<std::string()> m_collect;
+  int m_socket;
+  std::string m_path;
+
+  std::atomic<bool> m_running;
+  std::thread m_thread;
+};
+
+#endif
@@ -17,167 +17,341 @@
 
 #include "cluon-complete.hpp"
 #include "opendlv-standard-message-set.hpp"
+#include "binary-log.hpp"
+#include "command-address.hpp"
+#include "command-latency.hpp"
+#include "command-queue.hpp"
+#include "command-status.hpp"
+#include "log-layout.hpp"
+#include "metered-od4-session.hpp"
+#include "metrics-server.hpp"
+#include "radio-link.hpp"
+#include "radio-pool.hpp"
+#include "setpoint-streamer.hpp"
+#include "swarm-broadcaster.hpp"
+#include "toc-cache.hpp"
+#include "trajectory.hpp"
+#include "wake-signal.hpp"
 #include <cstdint>
 #include <iostream>
-#include <memory>
-#include <mutex>
 #include <thread>
-#include <array>
 #include <string>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
 #include <sstream>
+#include <utility>
 #include <vector>
-#include <iterator>
-
-#include <boost/program_options.hpp>
-#include <crazyflie_cpp/Crazyflie.h>
-#include <chrono>
 
-#include <cmath>
-
-struct log {
-  float x;
-  float y;
-  float z;
-  float pitch;
-  float yaw;
-  float pm_vbat;
-} __attribute__((packed));
-
-struct command {
-  float x;
-  float y;
-  float z;
-  float yaw;
-  float vx;
-  float vy;
-  float yawRate;
-  float height;
-  float time;
-  int16_t Type;
-} __attribute__((packed));
+int32_t main(int32_t argc, char **argv) {
+    int32_t retCode{1};
+    auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
+    if ( (0 == commandlineArguments.count("cid")) ) {
+        std::cerr << "You should include the cid to start communicate in OD4Session" << std::endl;
+        return retCode;
+    }
 
-volatile bool g_done = false;
+    // Either one drone given by radiouri and frameId, or several as
+    // --drones=frameId@radiouri,frameId@radiouri,... sharing this process
+    std::vector<std::pair<int16_t, std::string>> drones;
+    if ( 0 != commandlineArguments.count("drones") ) {
+        std::stringstream stream(commandlineArguments["drones"]);
+        std::string entry;
+        while (std::getline(stream, entry, ',')) {
+            std::string::size_type const at{entry.find('@')};
+            if ( at == std::string::npos ) {
+                std::cerr << "Invalid drone '" << entry << "', expected frameId@radiouri" << std::endl;
+                return retCode;
+            }
+            drones.emplace_back(static_cast<int16_t>(std::stoi(entry.substr(0, at))), entry.substr(at + 1));
+        }
+    } else {
+        if ( (0 == commandlineArguments.count("radiouri")) ) {
+            std::cerr << "You should include the radiouri to start communicate to crazyflie" << std::endl;
+            return retCode;
+        }
 
-void onLogData(uint32_t /*time_in_ms*/, const struct log* data)
-{
-    // std::cout << data->pm_extVbat << std::endl;
-    // std::cout << data->pm_extCurr << std::endl;
-    g_done = true;
-}
+        if ( (0 == commandlineArguments.count("frameId")) ) {
+            std::cerr << "You should include the frameId to specify which crazyflie are you refering to" << std::endl;
+            return retCode;
+        }
+        drones.emplace_back(static_cast<int16_t>(std::stoi(commandlineArguments["frameId"])), commandlineArguments["radiouri"]);
+    }
 
-bool InitializeCrazyflie(std::unique_ptr<Crazyflie>& cf, std::unique_ptr<LogBlock<struct log> >& logBlock, const std::string& uri, cluon::OD4Session& od4, bool verbose, bool test_mode, int16_t frame_id) {
-    std::cout << "Initializing Crazyflie..." << std::endl;
+    RadioLinkConfig linkConfig;
+    // Incoming packets are pumped and the link kept alive at least this often
+    linkConfig.pumpPeriod = std::chrono::milliseconds{ (commandlineArguments.count("keepalive") != 0) ? std::stoi(commandlineArguments["keepalive"]) : 1 };
+    // Upper bound for the exponential backoff between link recovery attempts
+    linkConfig.maxBackoff = std::chrono::milliseconds{ (commandlineArguments.count("max-backoff") != 0) ? std::stoi(commandlineArguments["max-backoff"]) : 1000 };
+    // A link that could not be recovered for this long in ms is given up,
+    // 0 keeps trying for as long as the process runs
+    linkConfig.recoveryTimeout = std::chrono::milliseconds{ (commandlineArguments.count("recovery-timeout") != 0) ? std::stoi(commandlineArguments["recovery-timeout"]) : 30000 };
+    // Pose, battery and kinematics are logged at independent rates in Hz,
+    // further variables can be listed as group.name@rate or in a file
+    bool const compressed{commandlineArguments.count("compressed") != 0};
+    const float poseRate{ (commandlineArguments.count("pose-rate") != 0) ? std::stof(commandlineArguments["pose-rate"]) : 100.0f };
+    const float batteryRate{ (commandlineArguments.count("battery-rate") != 0) ? std::stof(commandlineArguments["battery-rate"]) : 1.0f };
+    const float kinematicRate{ (commandlineArguments.count("kinematic-rate") != 0) ? std::stof(commandlineArguments["kinematic-rate"]) : 0.0f };
     try{
-        cf.reset(new Crazyflie(uri));
-        cf->logReset();
-        cf->requestLogToc();
+        linkConfig.logGroups = defaultLogGroups(compressed, poseRate, batteryRate, kinematicRate);
+        if ( commandlineArguments.count("log-config") != 0 ){
+            linkConfig.logGroups = mergeLogGroups(linkConfig.logGroups, readLogGroups(commandlineArguments["log-config"]));
+        }
+        if ( commandlineArguments.count("log") != 0 ){
+            linkConfig.logGroups = mergeLogGroups(linkConfig.logGroups, parseLogGroups(commandlineArguments["log"]));
+        }
+    }
+    catch(std::exception& e){
+        std::cerr << "Invalid log configuration: " << e.what() << std::endl;
+        return retCode;
+    }
+    const bool verbose{commandlineArguments.count("verbose") != 0};
+    linkConfig.verbose = verbose;
+    // Drones sharing a Crazyradio take turns of this many packets
+    linkConfig.airtimeBudget = (commandlineArguments.count("airtime-budget") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["airtime-budget"])) : 1;
+    // Setpoints can be streamed at a fixed rate in Hz, a stale one is held,
+    // turned into hovering in place, or stops the motors
+    const float streamRate{ (commandlineArguments.count("stream-rate") != 0) ? std::stof(commandlineArguments["stream-rate"]) : 0.0f };
+    const int32_t streamPriority{ (commandlineArguments.count("stream-priority") != 0) ? std::stoi(commandlineArguments["stream-priority"]) : 0 };
+    // Setpoints for a drone are sent at most at this rate in Hz, 0 for no limit
+    const float setpointRate{ (commandlineArguments.count("setpoint-rate") != 0) ? std::stof(commandlineArguments["setpoint-rate"]) : 0.0f };
+    linkConfig.setpointPeriod = std::chrono::microseconds{ (setpointRate > 0.0f) ? static_cast<int64_t>(1e6f / setpointRate) : 0 };
+    linkConfig.setpointTimeout = std::chrono::milliseconds{ (commandlineArguments.count("setpoint-timeout") != 0) ? std::stoi(commandlineArguments["setpoint-timeout"]) : 500 };
+    try{
+        linkConfig.stalePolicy = toStalePolicy((commandlineArguments.count("stale-setpoint") != 0) ? commandlineArguments["stale-setpoint"] : "hover");
+    }
+    catch(std::exception& e){
+        std::cerr << e.what() << std::endl;
+        return retCode;
+    }
+    // Takeoff, land and stop that are not acknowledged are sent again up to
+    // this many attempts in total, as long as they are not older than the
+    // timeout in ms. Broadcasts are repeated as often.
+    linkConfig.commandAttempts = (commandlineArguments.count("command-attempts") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["command-attempts"])) : 3;
+    linkConfig.commandTimeout = std::chrono::milliseconds{ (commandlineArguments.count("command-timeout") != 0) ? std::stoi(commandlineArguments["command-timeout"]) : 1000 };
+    RadioPoolConfig poolConfig;
+    // The airtime share of the drones on a shared radio is printed this
+    // often in seconds, by default only with --verbose
+    poolConfig.reportPeriod = std::chrono::seconds{ (commandlineArguments.count("airtime-report") != 0) ? std::stoi(commandlineArguments["airtime-report"]) : (verbose ? 10 : 0) };
+    // Spread the drones over all attached Crazyradios by load, the radio in
+    // their URIs is ignored then
+    poolConfig.shard = (commandlineArguments.count("shard") != 0);
+    poolConfig.capacity = (commandlineArguments.count("radio-capacity") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["radio-capacity"])) : 1000;
+    poolConfig.balancePeriod = std::chrono::seconds{ (commandlineArguments.count("balance-period") != 0) ? std::stoi(commandlineArguments["balance-period"]) : 5 };
 
-        // std::unique_ptr<LogBlock<struct log> > logBlock;
-        std::function<void(uint32_t, const struct log*)> cb = 
-        [&od4, &verbose, &test_mode, &frame_id](uint32_t /*time_in_ms*/, const struct log* data) {
-            if ( verbose ){
-                std::cout << "Message received, x:" << data->x << ", y:" << data->y << ", z:" << data->z << ", pitch:" << data->pitch << ", yaw:" << data->yaw << ", voltage:" << data->pm_vbat << std::endl;
+    // High-level commander groups as --groups=frameId@mask,... or
+    // --group-mask for a single drone, group commands are broadcast
+    std::map<int16_t, uint8_t> groupMasks;
+    if ( 0 != commandlineArguments.count("groups") ) {
+        std::stringstream stream(commandlineArguments["groups"]);
+        std::string entry;
+        while (std::getline(stream, entry, ',')) {
+            std::string::size_type const at{entry.find('@')};
+            if ( at == std::string::npos ) {
+                std::cerr << "Invalid group '" << entry << "', expected frameId@mask" << std::endl;
+                return retCode;
             }
+            groupMasks[static_cast<int16_t>(std::stoi(entry.substr(0, at)))] = static_cast<uint8_t>(std::stoi(entry.substr(at + 1), nullptr, 0));
+        }
+    } else if ( 0 != commandlineArguments.count("group-mask") ) {
+        groupMasks[drones.front().first] = static_cast<uint8_t>(std::stoi(commandlineArguments["group-mask"], nullptr, 0));
+    }
 
-            // Send message by od4
-            opendlv::sim::Frame frame;
-            opendlv::logic::sensation::CrazyFlieState cfState;
-            cfState.battery_state(data->pm_vbat);
-            cfState.cur_yaw(data->yaw / 180.0f * M_PI);
-
-            frame.x(data->x);
-            frame.y(data->y);
-            frame.z(data->z);
-            frame.pitch(data->pitch / 180.0f * M_PI);
-            frame.yaw(data->yaw / 180.0f * M_PI);
-            
-            // if ( test_mode ){
-            //     frame.x(1.0f);
-            //     frame.y(0.0f);
-            //     frame.z(1.0f);
-            //     frame.yaw(180.0f / 180.0f * M_PI);
-            // }
+    // Motion capture poses, published as Frame with senderStamp frameId +
+    // mocap-offset, are forwarded to the onboard estimators. The offset
+    // keeps them apart from the Frames published from the telemetry.
+    const int32_t mocapOffset{ (commandlineArguments.count("mocap-offset") != 0) ? std::stoi(commandlineArguments["mocap-offset"]) : 0 };
+    const float mocapRate{ (mocapOffset != 0) ? ((commandlineArguments.count("mocap-rate") != 0) ? std::stof(commandlineArguments["mocap-rate"]) : 100.0f) : 0.0f };
+    // Send the orientation along, otherwise only the position
+    const bool mocapOrientation{commandlineArguments.count("mocap-orientation") != 0};
 
-            cluon::data::TimeStamp sampleTime;
-            od4.send(frame, sampleTime, frame_id);
-            od4.send(cfState, sampleTime, frame_id);
+    // Command and telemetry latency histograms are published this often in
+    // seconds, 0 to only print them at shutdown
+    const std::chrono::seconds latencyReportPeriod{ (commandlineArguments.count("latency-report") != 0) ? std::stoi(commandlineArguments["latency-report"]) : 10 };
 
-            g_done = true;
-        };
+    // Metrics for Prometheus are served on this TCP port of the loopback
+    // interface, or on this Unix socket
+    const uint16_t metricsPort{ (commandlineArguments.count("metrics-port") != 0) ? static_cast<uint16_t>(std::stoi(commandlineArguments["metrics-port"])) : static_cast<uint16_t>(0) };
+    const std::string metricsSocket{ (commandlineArguments.count("metrics-socket") != 0) ? absolutePath(commandlineArguments["metrics-socket"]) : "" };
 
-        logBlock.reset(new LogBlock<struct log>(
-            cf.get(),{
-            {"stateEstimate", "x"},
-            {"stateEstimate", "y"},
-            {"stateEstimate", "z"},
-            {"stateEstimate", "pitch"},
-            {"stateEstimate", "yaw"},
-            {"pm", "vbat"}
-            // {"pm", "chargeCurrent"}
-            }, cb));
-        logBlock->start(1); // 100ms -> 10
+    // Command and verbose pose logging goes to this file in the format of
+    // binary-log.hpp instead of the console, with room for this many records
+    // that are not written yet
+    const std::string binaryLogFile{ (commandlineArguments.count("binary-log") != 0) ? absolutePath(commandlineArguments["binary-log"]) : "" };
+    const uint32_t binaryLogSize{ (commandlineArguments.count("binary-log-size") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["binary-log-size"])) : 65536 };
+    // Adds a timeline of the radio, OD4 and recovery threads to the binary
+    // log, decode-binary-log --chrome-trace turns it into a Chrome trace
+    const bool isTracing{commandlineArguments.count("trace") != 0};
+    if ( isTracing && binaryLogFile.empty() ){
+        std::cerr << "--trace needs --binary-log" << std::endl;
+        return retCode;
+    }
 
-        // Check that whether the connection succeed
-        // std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        // while (true) {
-        //     cf->sendPing();
-        //     std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        // }
-        // std::cout << "Connection succeed!!" << std::endl;
+    const uint32_t queueSize{ (commandlineArguments.count("queue-size") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["queue-size"])) : 64 };
+    // The log TOC is cached per firmware TOC CRC in this directory, which
+    // becomes the working directory before any thread is started
+    const std::string tocCacheDirectory{ (commandlineArguments.count("toc-cache") != 0) ? commandlineArguments["toc-cache"] : "/tmp/crazyflie-toc-cache" };
+    TocCache tocCache(tocCacheDirectory);
 
-        return true;
-    }
-    catch(std::exception& e){
-        std::cerr << "Initialize failed due to: " << e.what() << std::endl;
-        return false;
+    BinaryLog binaryLog(binaryLogSize);
+    if ( !binaryLogFile.empty() ){
+        try{
+            binaryLog.open(binaryLogFile);
+        }
+        catch(std::exception& e){
+            std::cerr << e.what() << std::endl;
+            return retCode;
+        }
+        if ( isTracing ){
+            binaryLog.enableTracing();
+            binaryLog.nameThread(ThreadRole::Main);
+        }
     }
-}
 
-int32_t main(int32_t argc, char **argv) {
-    int32_t retCode{1};
-    auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
-    if ( (0 == commandlineArguments.count("cid")) ) {
-        std::cerr << "You should include the cid to start communicate in OD4Session" << std::endl;
-        return retCode;
-    }
+    // Create a od4 session
+    MeteredOD4Session od4{static_cast<uint16_t>(std::stoi(commandlineArguments["cid"])), binaryLog};
 
-    if ( (0 == commandlineArguments.count("radiouri")) ) {
-        std::cerr << "You should include the radiouri to start communicate to crazyflie" << std::endl;
-        return retCode;
-    }
-    
-    if ( (0 == commandlineArguments.count("frameId")) ) {
-        std::cerr << "You should include the frameId to specify which crazyflie are you refering to" << std::endl;
-        return retCode;
+    // Every drone has its own command queue and link, the links to drones on
+    // the same Crazyradio are served by one scheduler thread sharing its
+    // airtime. Any new command wakes the schedulers up.
+    WakeSignal wakeSignal;
+    SetpointStreamer streamer(streamRate, streamPriority, wakeSignal);
+    std::vector<std::unique_ptr<CommandQueue>> commandQueues;
+    std::vector<std::unique_ptr<RadioLink>> links;
+    // Every link keeps the latency of its own commands, this one is for the
+    // broadcasts
+    CommandLatency broadcastLatency;
+    SwarmBroadcaster broadcaster(queueSize, wakeSignal, od4, broadcastLatency, binaryLog, linkConfig.commandAttempts, mocapRate, mocapOrientation);
+    RadioPool radioPool(poolConfig, wakeSignal, broadcaster);
+    for (auto const &drone : drones) {
+        linkConfig.frameId = drone.first;
+        linkConfig.uri = radioPool.assign(drone.second);
+        linkConfig.groupMask = groupMasks[drone.first];
+        try{
+            broadcaster.addChannel(drone.first, linkConfig.uri);
+        }
+        catch(std::exception& e){
+            std::cerr << e.what() << std::endl;
+            return retCode;
+        }
+        commandQueues.emplace_back(new CommandQueue(queueSize, wakeSignal));
+        int16_t const frameId{drone.first};
+        commandQueues.back()->onSuperseded([&od4, frameId](command const &cmd) {
+            reportCommandStatus(od4, cmd, frameId, CommandState::Failed, 0);
+        });
+        links.emplace_back(new RadioLink(linkConfig, od4, *commandQueues.back(), tocCache, wakeSignal, streamer, binaryLog));
+        radioPool.add(*links.back());
     }
+    broadcaster.holdWhile([&links]() {
+        return std::any_of(links.begin(), links.end(), [](std::unique_ptr<RadioLink> const &link) {
+            return link->isEndingSetpoints();
+        });
+    });
 
-    const std::string str_uri{commandlineArguments["radiouri"]};
-    const int16_t frame_id{ static_cast<int16_t>(std::stoi(commandlineArguments["frameId"])) };
-    bool const verbose{commandlineArguments.count("verbose") != 0};
-    bool const test_mode{commandlineArguments.count("test_mode") != 0};
+    // Whether any drone of this process is addressed, checked on the
+    // senderStamp alone so that commands for drones served by other
+    // instances on the same CID are not even decoded
+    auto isAddressed = [&drones, &groupMasks](CommandAddress const &address) {
+        switch (address.scope) {
+            case CommandScope::All:
+                return true;
+            case CommandScope::Group:
+                return std::any_of(groupMasks.begin(), groupMasks.end(), [&address](std::pair<int16_t const, uint8_t> const &groupMask) {
+                    return 0 != (groupMask.second & address.target);
+                });
+            case CommandScope::Drone:
+                return std::any_of(drones.begin(), drones.end(), [&address](std::pair<int16_t, std::string> const &drone) {
+                    return static_cast<uint16_t>(drone.first) == address.target;
+                });
+        }
+        return false;
+    };
 
-    // Create a od4 session
-    cluon::OD4Session od4{static_cast<uint16_t>(std::stoi(commandlineArguments["cid"]))};
+    auto isDroneAddressed = [&drones, &groupMasks](CommandAddress const &address, size_t drone) {
+        switch (address.scope) {
+            case CommandScope::All:
+                return true;
+            case CommandScope::Group:
+                return 0 != (groupMasks.at(drones[drone].first) & address.target);
+            case CommandScope::Drone:
+                return static_cast<uint16_t>(drones[drone].first) == address.target;
+        }
+        return false;
+    };
+
+    // Commands for all go to every drone just like they reach every instance
+    // when each drone has its own process, group commands are broadcast once
+    auto deliver = [&od4, &drones, &commandQueues, &links, &broadcaster, &binaryLog, &isDroneAddressed](CommandAddress const &address, command &inputCommand){
+        TraceScope trace(binaryLog, TraceEvent::Enqueue, -1, static_cast<float>(inputCommand.Type));
+        binaryLog.log(LogEvent::CommandReceived, -1, {static_cast<float>(inputCommand.Type), static_cast<float>(address.scope), static_cast<float>(address.target)});
+        if ( CommandScope::Group == address.scope && !isSetpointCommand(inputCommand) ){
+            inputCommand.groupMask = static_cast<uint8_t>(address.target);
+            // The members still on low-level setpoints would ignore the
+            // broadcast, they are handed back first
+            for (size_t i{0}; i < links.size(); i++) {
+                if ( isDroneAddressed(address, i) ){
+                    links[i]->endSetpoints();
+                }
+            }
+            if ( !broadcaster.push(inputCommand) ){
+                std::cerr << "Broadcast queue full, dropped command with type: " << inputCommand.Type << " (" << broadcaster.dropped() << " dropped so far)" << std::endl;
+                reportCommandStatus(od4, inputCommand, kBroadcastFrameId, CommandState::Failed, 0);
+            } else {
+                reportCommandStatus(od4, inputCommand, kBroadcastFrameId, CommandState::Queued, 0);
+            }
+            if ( !binaryLog.isOpen() ){
+                std::cout << "Command received with type: " << inputCommand.Type << " for group mask " << address.target << std::endl;
+            }
+            return;
+        }
+        // Setpoints have no group mask, they go to the group members one by
+        // one. The dispatchers are woken up right away instead of waiting
+        // for the next poll.
+        for (size_t i{0}; i < commandQueues.size(); i++) {
+            if ( !isDroneAddressed(address, i) ){
+                continue;
+            }
+            if ( !links[i]->isRunning() ){
+                reportCommandStatus(od4, inputCommand, drones[i].first, CommandState::Failed, 0);
+                continue;
+            }
+            if ( !commandQueues[i]->push(inputCommand) ){
+                std::cerr << "Command queue full, dropped command with type: " << inputCommand.Type << " (" << commandQueues[i]->dropped() << " dropped so far)" << std::endl;
+                reportCommandStatus(od4, inputCommand, drones[i].first, CommandState::Failed, 0);
+            } else {
+                reportCommandStatus(od4, inputCommand, drones[i].first, CommandState::Queued, 0);
+            }
+        }
+        if ( !binaryLog.isOpen() ){
+            std::cout << "Command received with type: " << inputCommand.Type << std::endl;
+        }
+    };
 
-    // Try to connect to crazyflie
-    std::unique_ptr<Crazyflie> cf;
-    std::unique_ptr<LogBlock<struct log> > logBlock;
-    if ( !InitializeCrazyflie( cf, logBlock, str_uri, od4, verbose, test_mode, frame_id) )
-        return 1;    
-    std::cout << "Connected to crazyflie." << std::endl;
+    // Keeps what identifies the command message, for the status of the command
+    auto stampCommand = [](command &inputCommand, cluon::data::Envelope const &env){
+        inputCommand.senderStamp = env.senderStamp();
+        inputCommand.issuedUs = cluon::time::toMicroseconds(env.sent());
+        inputCommand.receivedUs = cluon::time::toMicroseconds(env.received());
+    };
 
-    // Connect to the od4 session 
-    std::mutex Mutex;
-    command inputCommand;
-    bool isCommandReceived = false;
-    auto onCommandReceived = [&Mutex, &inputCommand, &isCommandReceived](cluon::data::Envelope &&env){
+    // Connect to the od4 session
+    std::atomic<uint64_t> skippedCommands{0};
+    auto onCommandReceived = [&deliver, &isAddressed, &stampCommand, &skippedCommands](cluon::data::Envelope &&env){
         auto senderStamp = env.senderStamp();
+        CommandAddress const address{toCommandAddress(senderStamp)};
+        if ( !isAddressed(address) ){
+            skippedCommands++;
+            return;
+        }
+        // Use the command to send to crazyflie
+        command inputCommand{};
+        stampCommand(inputCommand, env);
         // Now, we unpack the cluon::data::Envelope to get the desired DistanceReading.
         opendlv::logic::action::CrazyFlieCommand cfcommand = cluon::extractMessage<opendlv::logic::action::CrazyFlieCommand>(std::move(env));
 
-        // Use the command to send to crazyflie
-        std::lock_guard<std::mutex> lck(Mutex);
-        switch (senderStamp) {
+        switch (address.kind) {
             case 0: // Takeoff
                 inputCommand.Type = 0;
                 inputCommand.height = cfcommand.height();
@@ -206,64 +380,262 @@ int32_t main(int32_t argc, char **argv) {
                 inputCommand.yawRate = cfcommand.yawRate();
                 inputCommand.z = cfcommand.z();
                 break;
+            case 5: // Position
+                inputCommand.Type = 5;
+                inputCommand.x = cfcommand.x();
+                inputCommand.y = cfcommand.y();
+                inputCommand.z = cfcommand.z();
+                inputCommand.yaw = cfcommand.yaw();
+                break;
+            default:
+                std::cerr << "Unknown command type: " << senderStamp << std::endl;
+                return;
+        }
+        deliver(address, inputCommand);
+    };
+    // Full-state setpoints are addressed like the commands, the kind in the
+    // senderStamp is not used
+    auto onFullStateReceived = [&deliver, &isAddressed, &stampCommand, &skippedCommands](cluon::data::Envelope &&env){
+        CommandAddress const address{toCommandAddress(env.senderStamp())};
+        if ( !isAddressed(address) ){
+            skippedCommands++;
+            return;
+        }
+        command inputCommand{};
+        stampCommand(inputCommand, env);
+        opendlv::logic::action::CrazyFlieFullStateSetpoint setpoint = cluon::extractMessage<opendlv::logic::action::CrazyFlieFullStateSetpoint>(std::move(env));
+
+        inputCommand.Type = 6;
+        inputCommand.x = setpoint.x();
+        inputCommand.y = setpoint.y();
+        inputCommand.z = setpoint.z();
+        inputCommand.vx = setpoint.vx();
+        inputCommand.vy = setpoint.vy();
+        inputCommand.vz = setpoint.vz();
+        inputCommand.ax = setpoint.ax();
+        inputCommand.ay = setpoint.ay();
+        inputCommand.az = setpoint.az();
+        inputCommand.qx = setpoint.qx();
+        inputCommand.qy = setpoint.qy();
+        inputCommand.qz = setpoint.qz();
+        inputCommand.qw = setpoint.qw();
+        inputCommand.rollRate = setpoint.rollRate();
+        inputCommand.pitchRate = setpoint.pitchRate();
+        inputCommand.yawRate = setpoint.yawRate();
+        deliver(address, inputCommand);
+    };
+    // Trajectories are uploaded to every addressed drone on its own link, a
+    // trajectory without pieces or waypoints starts one uploaded before
+    auto onTrajectoryReceived = [&od4, &drones, &links, &binaryLog, verbose, &deliver, &isAddressed, &isDroneAddressed, &stampCommand, &skippedCommands](cluon::data::Envelope &&env){
+        CommandAddress const address{toCommandAddress(env.senderStamp())};
+        if ( !isAddressed(address) ){
+            skippedCommands++;
+            return;
+        }
+        command inputCommand{};
+        stampCommand(inputCommand, env);
+        opendlv::logic::action::CrazyFlieTrajectory trajectory = cluon::extractMessage<opendlv::logic::action::CrazyFlieTrajectory>(std::move(env));
+        // A timescale left out runs the trajectory at its own pace
+        float const timescale{(trajectory.timescale() > 0.0f) ? trajectory.timescale() : 1.0f};
+
+        inputCommand.Type = 7;
+        inputCommand.trajectoryId = trajectory.trajectoryId();
+        inputCommand.timescale = timescale;
+        inputCommand.relative = trajectory.relative();
+        inputCommand.reversed = trajectory.reversed();
+        if ( trajectory.pieces().empty() && trajectory.waypoints().empty() ){
+            deliver(address, inputCommand);
+            return;
+        }
+        TrajectoryUpload upload{trajectory.trajectoryId(), {}, trajectory.start(), timescale, trajectory.relative(), trajectory.reversed(), inputCommand, 0};
+        try{
+            upload.pieces = trajectory.pieces().empty() ? fitWaypoints(trajectory.waypoints()) : unpackPieces(trajectory.pieces());
+        }
+        catch(std::exception& e){
+            std::cerr << "Invalid trajectory " << static_cast<uint32_t>(trajectory.trajectoryId()) << ": " << e.what() << std::endl;
+            return;
+        }
+        for (size_t i{0}; i < links.size(); i++) {
+            if ( isDroneAddressed(address, i) ){
+                links[i]->uploadTrajectory(upload);
+                reportCommandStatus(od4, inputCommand, drones[i].first, CommandState::Queued, 0);
+            }
+        }
+        if ( binaryLog.isOpen() ){
+            binaryLog.log(LogEvent::CommandReceived, -1, {static_cast<float>(inputCommand.Type), static_cast<float>(address.scope), static_cast<float>(address.target)});
+        } else if ( verbose ){
+            std::cout << "Trajectory " << static_cast<uint32_t>(upload.trajectoryId) << " received with " << upload.pieces.size() << " pieces." << std::endl;
+        }
+    };
+    // Only the latest pose of every drone is kept, frames of drones of other
+    // instances are not decoded
+    auto onMocapReceived = [&drones, &broadcaster, mocapOffset](cluon::data::Envelope &&env){
+        int32_t const frameId{static_cast<int32_t>(env.senderStamp()) - mocapOffset};
+        for (auto const &drone : drones) {
+            if ( drone.first == frameId ){
+                opendlv::sim::Frame frame = cluon::extractMessage<opendlv::sim::Frame>(std::move(env));
+                broadcaster.updatePose(drone.first, frame.x(), frame.y(), frame.z(), frame.roll(), frame.pitch(), frame.yaw());
+                return;
+            }
         }
-        isCommandReceived = true;
-        std::cout << "Command received with type: " << senderStamp << std::endl; 
     };
     // Finally, we register our lambda for the message identifier for opendlv::proxy::DistanceReading.
     od4.dataTrigger(opendlv::logic::action::CrazyFlieCommand::ID(), onCommandReceived);  
+    od4.dataTrigger(opendlv::logic::action::CrazyFlieFullStateSetpoint::ID(), onFullStateReceived);
+    od4.dataTrigger(opendlv::logic::action::CrazyFlieTrajectory::ID(), onTrajectoryReceived);
+    if ( mocapRate > 0.0f ){
+        od4.dataTrigger(opendlv::sim::Frame::ID(), onMocapReceived);
+    }
     std::cout << "Subscribe to od4." << std::endl;
 
-    // Start the looping here
-    while(od4.isRunning()){
-        // std::cout << "Loop start..." << std::endl;
-        try{
-            if (true) {
-                cf->sendPing();
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    // Try to connect to the crazyflies, afterwards the links are only used
+    // from the scheduler thread of their radio
+    for (auto &link : links) {
+        if ( !link->connect() )
+            return 1;
+    }
+    std::cout << "Connected to " << links.size() << " crazyflie(s) on " << radioPool.radioCount() << " radio(s)." << std::endl;
+    for (auto &link : links) {
+        link->start();
+    }
+    radioPool.start();
+    try{
+        streamer.start();
+    }
+    catch(std::exception& e){
+        std::cerr << e.what() << std::endl;
+        radioPool.stop();
+        return retCode;
+    }
+
+    auto collectMetrics = [&od4, &links, &commandQueues, &broadcaster, &binaryLog, &skippedCommands]() {
+        char const *const trafficNames[] = {"emergency", "setpoint", "configuration", "keepalive"};
+        MetricsText text;
+        text.family("crazyflie_radio_packets_total", "counter", "Packets sent to the Crazyflie by traffic class, keepalive are empty pings.");
+        for (auto const &link : links) {
+            for (uint32_t traffic{0}; traffic < kTrafficClassCount; traffic++) {
+                text.sample("crazyflie_radio_packets_total", "frame=\"" + std::to_string(link->frameId()) + "\",class=\"" + trafficNames[traffic] + "\"", static_cast<double>(link->packets(static_cast<TrafficClass>(traffic))));
+            }
+        }
+        struct LinkMetric {
+          char const *name;
+          char const *type;
+          char const *help;
+          LinkStatistic statistic;
+          double scale;
+        };
+        LinkMetric const linkMetrics[] = {
+            {"crazyflie_radio_received_packets_total", "counter", "Log packets received from the Crazyflie.", LinkStatistic::ReceivedPackets, 1.0},
+            {"crazyflie_commands_acked_total", "counter", "Commands acknowledged by the Crazyflie.", LinkStatistic::Acked, 1.0},
+            {"crazyflie_commands_failed_total", "counter", "Commands that failed for good.", LinkStatistic::Failed, 1.0},
+            {"crazyflie_commands_retried_total", "counter", "Attempts after the first to send a command.", LinkStatistic::Retried, 1.0},
+            {"crazyflie_link_reconnects_total", "counter", "Recoveries that brought the link back.", LinkStatistic::Reconnects, 1.0},
+            {"crazyflie_initializations_total", "counter", "Full initializations of the link.", LinkStatistic::Initializations, 1.0},
+            {"crazyflie_initialize_seconds_total", "counter", "Time spent in full initializations of the link.", LinkStatistic::InitializeUs, 1e-6}
+        };
+        for (auto const &metric : linkMetrics) {
+            text.family(metric.name, metric.type, metric.help);
+            for (auto const &link : links) {
+                text.sample(metric.name, "frame=\"" + std::to_string(link->frameId()) + "\"", metric.scale * static_cast<double>(link->statistic(metric.statistic)));
             }
-            // continue;
-            // std::cout << "Connection succeed!!" << std::endl;
+        }
 
-            // std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        text.family("crazyflie_command_queue_depth", "gauge", "Commands waiting in the queue of a drone.");
+        for (size_t i{0}; i < links.size(); i++) {
+            text.sample("crazyflie_command_queue_depth", "frame=\"" + std::to_string(links[i]->frameId()) + "\"", commandQueues[i]->depth());
+        }
+        text.family("crazyflie_commands_dropped_total", "counter", "Commands dropped because the queue was full.");
+        for (size_t i{0}; i < links.size(); i++) {
+            text.sample("crazyflie_commands_dropped_total", "frame=\"" + std::to_string(links[i]->frameId()) + "\"", static_cast<double>(commandQueues[i]->dropped()));
+        }
+        text.sample("crazyflie_commands_dropped_total", "frame=\"broadcast\"", static_cast<double>(broadcaster.dropped()));
+        text.family("crazyflie_commands_coalesced_total", "counter", "Setpoints and stops replaced by newer ones in the queue.");
+        for (size_t i{0}; i < links.size(); i++) {
+            text.sample("crazyflie_commands_coalesced_total", "frame=\"" + std::to_string(links[i]->frameId()) + "\"", static_cast<double>(commandQueues[i]->coalesced()));
+        }
+        text.family("crazyflie_commands_superseded_total", "counter", "Commands overtaken by a stop.");
+        for (size_t i{0}; i < links.size(); i++) {
+            text.sample("crazyflie_commands_superseded_total", "frame=\"" + std::to_string(links[i]->frameId()) + "\"", static_cast<double>(commandQueues[i]->superseded()));
+        }
+        text.family("crazyflie_commands_skipped_total", "counter", "Commands for drones of other instances.");
+        text.sample("crazyflie_commands_skipped_total", "", static_cast<double>(skippedCommands));
 
-            if ( isCommandReceived == false )
-                continue;
+        text.family("crazyflie_binary_log_dropped_total", "counter", "Records that did not fit into the binary log ring.");
+        text.sample("crazyflie_binary_log_dropped_total", "", static_cast<double>(binaryLog.dropped()));
+
+        text.family("crazyflie_od4_messages_total", "counter", "OD4 messages received and sent by message ID.");
+        for (auto const &count : od4.received()) {
+            text.sample("crazyflie_od4_messages_total", "direction=\"in\",id=\"" + std::to_string(count.first) + "\"", static_cast<double>(count.second));
+        }
+        for (auto const &count : od4.sent()) {
+            text.sample("crazyflie_od4_messages_total", "direction=\"out\",id=\"" + std::to_string(count.first) + "\"", static_cast<double>(count.second));
+        }
+        return text.str();
+    };
+    MetricsServer metricsServer(collectMetrics);
+    try{
+        if ( 0 != metricsPort ){
+            metricsServer.listenTcp(metricsPort);
+        } else if ( !metricsSocket.empty() ){
+            metricsServer.listenUnix(metricsSocket);
+        }
+    }
+    catch(std::exception& e){
+        std::cerr << e.what() << std::endl;
+        streamer.stop();
+        radioPool.stop();
+        return retCode;
+    }
 
-            int16_t group_mask = 0;
-            std::cout << "Received command..." << std::endl;
-            switch (inputCommand.Type)
-            {
-                case 0: // Takeoff
-                    cf->takeoff(inputCommand.height, inputCommand.time, group_mask);
-                    break;
-                case 1: // Land
-                    cf->land(inputCommand.height, inputCommand.time, group_mask);
-                    break;
-                case 2: // Stop
-                    cf->stop(group_mask);
-                    break;
-                case 3: // Goto
-                    {
-                        bool relative = true;
-                        cf->goTo(inputCommand.x, inputCommand.y, inputCommand.z, inputCommand.yaw, inputCommand.time, relative, group_mask);
-                        break;                        
-                    }                    
-                case 4: // Hovering
-                    cf->sendHoverSetpoint(inputCommand.vx, inputCommand.vy, inputCommand.yawRate, inputCommand.z);
-                    break;
+    // A drone that is lost does not take the links to the others down with
+    // it, the process only ends once no link is left
+    auto areAllLinksDown = [&links]() {
+        return std::none_of(links.begin(), links.end(), [](std::unique_ptr<RadioLink> const &link) {
+            return link->isRunning();
+        });
+    };
+    auto nextLatencyReport = std::chrono::steady_clock::now() + latencyReportPeriod;
+    while(od4.isRunning() && !areAllLinksDown()){
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if ( latencyReportPeriod.count() > 0 && std::chrono::steady_clock::now() >= nextLatencyReport ){
+            broadcastLatency.publish(od4, static_cast<uint32_t>(kBroadcastFrameId));
+            for (auto &link : links) {
+                link->publishCommandLatency();
+                link->publishTelemetryStatistics();
             }
-            isCommandReceived = false;
+            nextLatencyReport += latencyReportPeriod;
         }
-        catch(std::exception& e){
-            std::cerr << "Has some error with: " << e.what() << std::endl;
-            if ( !InitializeCrazyflie( cf, logBlock, str_uri, od4, verbose, test_mode, frame_id) )
-                return 1;    
-            std::cout << "Reconnected to crazyflie, sleep for a while..." << std::endl;
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        }        
     }
+    bool const isLinkLost{areAllLinksDown()};
+    metricsServer.stop();
+    streamer.stop();
+    radioPool.stop();
+    for (auto &link : links) {
+        link->stop();
+    }
+    if ( isLinkLost )
+        return retCode;
 
+    std::cout << "Skipped " << skippedCommands << " command(s) for drones of other instances." << std::endl;
+    for (size_t i{0}; i < drones.size(); i++) {
+        std::cout << "Command queue of frame " << drones[i].first << ": " << commandQueues[i]->dropped() << " dropped, " << commandQueues[i]->coalesced() << " coalesced, " << commandQueues[i]->superseded() << " superseded by a stop." << std::endl;
+    }
+    broadcastLatency.printStatistics("broadcasts");
+    for (auto &link : links) {
+        link->printCommandLatency();
+        link->printTelemetryStatistics();
+    }
+    streamer.printStatistics();
+    if ( binaryLog.isOpen() ){
+        binaryLog.close();
+        std::cout << "Binary log: " << binaryLog.dropped() << " record(s) dropped." << std::endl;
+    }
+    if ( streamer.isEnabled() ){
+        for (auto &link : links) {
+            StreamStatistics const stream{link->streamStatistics()};
+            std::cout << "Setpoint stream of frame " << link->frameId() << ": " << stream.sent << " sent, " << stream.missed << " ticks missed, " << stream.stale << " stale, delay mean " << ((stream.sent > 0) ? stream.sumDelayUs / static_cast<int64_t>(stream.sent) : 0) << " us, max " << stream.maxDelayUs << " us." << std::endl;
+        }
+    }
     retCode = 0;
     return retCode;
 }
\ No newline at end of file
@@ -0,0 +1,752 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "radio-link.hpp"
+#include "opendlv-standard-message-set.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+RadioLink::RadioLink(RadioLinkConfig const &config, MeteredOD4Session &od4,
+    CommandQueue &commandQueue, TocCache &tocCache, WakeSignal &wakeSignal,
+    SetpointStreamer &streamer, BinaryLog &log)
+  : m_config(config)
+  , m_od4(od4)
+  , m_commandQueue(commandQueue)
+  , m_tocCache(tocCache)
+  , m_wakeSignal(wakeSignal)
+  , m_streamer(streamer)
+  , m_latency()
+  , m_log(log)
+  , m_uriMutex()
+  , m_uri(config.uri)
+  , m_isRelocated(false)
+  , m_cf()
+  , m_telemetry(config.logGroups, config.frameId, od4, log, config.verbose)
+  , m_lastPacket()
+  , m_lastRearm()
+  , m_packets()
+  , m_lastSetpoint()
+  , m_isStreaming(false)
+  , m_hasSetpoints(false)
+  , m_isEndingSetpoints(false)
+  , m_streamSetpoint()
+  , m_streamSetpointTime()
+  , m_streamedTick(0)
+  , m_streamStatistics()
+  , m_uploadsMutex()
+  , m_uploads()
+  , m_hasUploads(false)
+  , m_trajectories()
+  , m_hasRetry(false)
+  , m_retry()
+  , m_retryAttempt(0)
+  , m_linkStatistics()
+  , m_running(false)
+  , m_recovering(false)
+  , m_recoveryThread()
+{
+    for (auto &packets : m_packets) {
+        packets = 0;
+    }
+    for (auto &count : m_linkStatistics) {
+        count = 0;
+    }
+}
+
+RadioLink::~RadioLink()
+{
+    stop();
+}
+
+bool RadioLink::connect()
+{
+    return initialize();
+}
+
+void RadioLink::start()
+{
+    m_running = true;
+}
+
+void RadioLink::stop()
+{
+    m_running = false;
+    if (m_recoveryThread.joinable()) {
+        m_recoveryThread.join();
+    }
+    if ( m_hasRetry ){
+        m_hasRetry = false;
+        reportStatus(m_retry, CommandState::Failed, m_retryAttempt - 1);
+    }
+}
+
+bool RadioLink::isRunning() const noexcept
+{
+    return m_running;
+}
+
+int16_t RadioLink::frameId() const noexcept
+{
+    return m_config.frameId;
+}
+
+uint32_t RadioLink::airtimeBudget() const noexcept
+{
+    return m_config.airtimeBudget;
+}
+
+std::string RadioLink::uri() const
+{
+    std::lock_guard<std::mutex> lck(m_uriMutex);
+    return m_uri;
+}
+
+uint32_t RadioLink::telemetryRate() const noexcept
+{
+    return m_telemetry.packetsPerSecond();
+}
+
+uint64_t RadioLink::statistic(LinkStatistic statistic) const noexcept
+{
+    if ( LinkStatistic::ReceivedPackets == statistic ){
+        return m_telemetry.packetsReceived();
+    }
+    return m_linkStatistics[static_cast<uint32_t>(statistic)];
+}
+
+void RadioLink::publishTelemetryStatistics() const
+{
+    m_telemetry.publishStatistics();
+}
+
+void RadioLink::printTelemetryStatistics() const
+{
+    m_telemetry.printStatistics();
+}
+
+void RadioLink::publishCommandLatency() const
+{
+    m_latency.publish(m_od4, static_cast<uint32_t>(m_config.frameId));
+}
+
+void RadioLink::printCommandLatency() const
+{
+    m_latency.printStatistics("frame " + std::to_string(m_config.frameId));
+}
+
+TrafficClass RadioLink::nextTraffic(std::chrono::steady_clock::time_point now) const noexcept
+{
+    if ( !m_running || m_recovering ){
+        return TrafficClass::None;
+    }
+    if ( m_isEndingSetpoints || m_commandQueue.hasEmergency() ){
+        return TrafficClass::Emergency;
+    }
+    if ( m_hasRetry ){
+        return isEmergencyCommand(m_retry) ? TrafficClass::Emergency : TrafficClass::Setpoint;
+    }
+    // Setpoints coming faster than the limit wait in the queue, where newer
+    // ones replace them
+    bool const isSetpointDue{now - m_lastSetpoint >= m_config.setpointPeriod};
+    if ( !m_commandQueue.empty() && (isSetpointDue || !m_commandQueue.isSetpointNext()) ){
+        return TrafficClass::Setpoint;
+    }
+    if ( m_isStreaming && m_streamer.tick() != m_streamedTick ){
+        return TrafficClass::Setpoint;
+    }
+    if ( m_hasUploads || (m_telemetry.hasBlocks() && now - std::max(m_telemetry.lastSample(), m_lastRearm) > stallTimeout()) ){
+        return TrafficClass::Configuration;
+    }
+    if ( now - m_lastPacket >= m_config.pumpPeriod ){
+        return TrafficClass::KeepAlive;
+    }
+    return TrafficClass::None;
+}
+
+std::chrono::steady_clock::time_point RadioLink::nextDeadline() const noexcept
+{
+    if ( !m_running || m_recovering ){
+        return std::chrono::steady_clock::time_point::max();
+    }
+    auto deadline = m_lastPacket + m_config.pumpPeriod;
+    if ( m_commandQueue.isSetpointNext() ){
+        deadline = std::min(deadline, m_lastSetpoint + m_config.setpointPeriod);
+    }
+    if ( m_telemetry.hasBlocks() ){
+        deadline = std::min(deadline, std::max(m_telemetry.lastSample(), m_lastRearm) + stallTimeout());
+    }
+    return deadline;
+}
+
+void RadioLink::transmit(TrafficClass traffic)
+{
+    m_log.nameThread(ThreadRole::Radio);
+    TraceScope trace(m_log, TraceEvent::Transmit, m_config.frameId, static_cast<float>(traffic));
+    try{
+        command pendingCommand;
+        switch (traffic) {
+            case TrafficClass::Emergency:
+                if ( m_isEndingSetpoints.exchange(false) && m_hasSetpoints ){
+                    stopSetpoints();
+                    // A held broadcast may go out on another radio now
+                    m_wakeSignal.notify();
+                } else if ( popCommand(true, pendingCommand) ){
+                    sendCommand(pendingCommand, 1);
+                } else if ( m_hasRetry ){
+                    retryCommand();
+                }
+                break;
+            case TrafficClass::Setpoint:
+                if ( m_hasRetry ){
+                    retryCommand();
+                } else if ( popCommand(false, pendingCommand) ){
+                    sendCommand(pendingCommand, 1);
+                } else if ( m_isStreaming ){
+                    streamSetpoint();
+                }
+                break;
+            case TrafficClass::Configuration:
+                if ( m_hasUploads ){
+                    // Memory writes are acknowledged in a window, count
+                    // them all towards the airtime used
+                    m_packets[static_cast<uint32_t>(traffic)] += sendUploads() - 1;
+                    break;
+                }
+                std::cerr << "No telemetry from frame " << m_config.frameId << " for " << stallTimeout().count() << " ms, re-arming the log blocks." << std::endl;
+                m_lastRearm = std::chrono::steady_clock::now();
+                m_telemetry.startBlocks();
+                break;
+            case TrafficClass::KeepAlive:
+                {
+                    TraceScope ping(m_log, TraceEvent::Ping, m_config.frameId);
+                    m_cf->sendPing();
+                }
+                break;
+            case TrafficClass::None:
+                return;
+        }
+        // The acknowledgement of any packet carries the pending incoming
+        // ones, the keepalive only has to fill the gaps
+        m_lastPacket = std::chrono::steady_clock::now();
+        m_packets[static_cast<uint32_t>(traffic)]++;
+    }
+    catch(std::exception& e){
+        std::cerr << "Has some error with: " << e.what() << std::endl;
+        startRecovery();
+    }
+}
+
+void RadioLink::relocate(std::string const &uri)
+{
+    bool isRecovering{false};
+    {
+        std::lock_guard<std::mutex> lck(m_uriMutex);
+        std::cout << "Moving frame " << m_config.frameId << " from " << m_uri << " to " << uri << "." << std::endl;
+        m_uri = uri;
+        m_isRelocated = true;
+        isRecovering = m_recovering;
+    }
+    // A recovery on a radio that is gone only ends with stop(), it must not
+    // be waited for
+    if ( !isRecovering ){
+        startRecovery();
+    }
+}
+
+void RadioLink::startRecovery()
+{
+    // Recovery blocks for as long as the backoff takes, which must not cost
+    // the other drones on the radio their airtime. The previous recovery
+    // thread has cleared m_recovering, it is done but for the wake up.
+    m_recovering = true;
+    if (m_recoveryThread.joinable()) {
+        m_recoveryThread.join();
+    }
+    m_recoveryThread = std::thread([this](){
+        m_log.nameThread(ThreadRole::Recovery);
+        for (;;) {
+            if ( !recover() ){
+                m_running = false;
+            }
+            m_lastPacket = std::chrono::steady_clock::now();
+            m_lastRearm = m_lastPacket;
+            // A relocation that came in after the last attempt needs another
+            // round on the new URI
+            std::lock_guard<std::mutex> lck(m_uriMutex);
+            if ( !m_running || !m_isRelocated ){
+                m_recovering = false;
+                break;
+            }
+        }
+        m_wakeSignal.notify();
+    });
+}
+
+StreamStatistics RadioLink::streamStatistics() const noexcept
+{
+    return m_streamStatistics;
+}
+
+void RadioLink::uploadTrajectory(TrajectoryUpload const &upload)
+{
+    {
+        std::lock_guard<std::mutex> lck(m_uploadsMutex);
+        m_uploads.push_back(upload);
+        m_hasUploads = true;
+    }
+    m_wakeSignal.notify();
+}
+
+void RadioLink::endSetpoints() noexcept
+{
+    m_isEndingSetpoints = true;
+    m_wakeSignal.notify();
+}
+
+bool RadioLink::isEndingSetpoints() const noexcept
+{
+    return m_isEndingSetpoints && m_running && !m_recovering;
+}
+
+uint64_t RadioLink::packets(TrafficClass traffic) const noexcept
+{
+    return m_packets[static_cast<uint32_t>(traffic)];
+}
+
+uint64_t RadioLink::packets() const noexcept
+{
+    uint64_t total{0};
+    for (auto const &packets : m_packets) {
+        total += packets;
+    }
+    return total;
+}
+
+std::chrono::milliseconds RadioLink::stallTimeout() const noexcept
+{
+    return std::max(std::chrono::milliseconds(500), 10 * m_telemetry.fastestPeriod());
+}
+
+bool RadioLink::initialize()
+{
+    std::cout << "Initializing Crazyflie..." << std::endl;
+    auto const start = std::chrono::steady_clock::now();
+    m_linkStatistics[static_cast<uint32_t>(LinkStatistic::Initializations)]++;
+    try{
+        m_telemetry.abandonBlocks();
+        // A rebooted Crazyflie must not take off from an old setpoint, and
+        // has forgotten its trajectories
+        m_isStreaming = false;
+        m_hasSetpoints = false;
+        m_trajectories.clear();
+        m_cf.reset(new Crazyflie(uri()));
+        m_telemetry.resetClock();
+        if ( 0 != m_config.groupMask ){
+            m_cf->setGroupMask(m_config.groupMask);
+        }
+        m_cf->logReset();
+        m_tocCache.requestLogToc(*m_cf);
+        m_telemetry.createBlocks(*m_cf);
+        m_telemetry.startBlocks();
+        m_lastPacket = std::chrono::steady_clock::now();
+        m_lastRearm = m_lastPacket;
+        m_linkStatistics[static_cast<uint32_t>(LinkStatistic::InitializeUs)] += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(m_lastPacket - start).count());
+
+        return true;
+    }
+    catch(std::exception& e){
+        std::cerr << "Initialize failed due to: " << e.what() << std::endl;
+        m_linkStatistics[static_cast<uint32_t>(LinkStatistic::InitializeUs)] += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+        return false;
+    }
+}
+
+bool RadioLink::recover()
+{
+    std::chrono::milliseconds backoff{10};
+    bool reinitializeOnly{false};
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t attempt{1}; m_running; attempt++) {
+        // A link on another radio has nothing left to retry or re-arm, and
+        // gets the full timeout there
+        if ( m_isRelocated.exchange(false) ){
+            reinitializeOnly = true;
+            backoff = std::chrono::milliseconds(10);
+            start = std::chrono::steady_clock::now();
+        }
+        if ( m_config.recoveryTimeout.count() > 0 && std::chrono::steady_clock::now() - start >= m_config.recoveryTimeout ){
+            std::cerr << "Giving up on frame " << m_config.frameId << " after " << attempt - 1 << " recovery attempt(s)." << std::endl;
+            return false;
+        }
+        if ( (!reinitializeOnly && runRecoveryPhase(RetryLink, attempt, &RadioLink::retryLink))
+            || (!reinitializeOnly && runRecoveryPhase(RearmLogBlocks, attempt, &RadioLink::rearmLogBlocks))
+            || runRecoveryPhase(Reinitialize, attempt, &RadioLink::initialize) ){
+            std::cout << "Reconnected to crazyflie." << std::endl;
+            m_linkStatistics[static_cast<uint32_t>(LinkStatistic::Reconnects)]++;
+            return true;
+        }
+        std::this_thread::sleep_for(backoff);
+        backoff = std::min(backoff * 2, m_config.maxBackoff);
+    }
+    return false;
+}
+
+bool RadioLink::runRecoveryPhase(RecoveryPhase phase, uint32_t attempt, bool (RadioLink::*step)())
+{
+    auto const start = std::chrono::steady_clock::now();
+    bool success{false};
+    {
+        TraceScope trace(m_log, TraceEvent::Recovery, m_config.frameId, static_cast<float>(phase));
+        success = (this->*step)();
+    }
+    auto const duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    std::cout << "Recovery phase " << static_cast<uint32_t>(phase) << " (attempt " << attempt << ") " << (success ? "succeeded" : "failed") << " after " << duration.count() << " us." << std::endl;
+    opendlv::system::CrazyFlieLinkRecovery recovery;
+    recovery.phase(phase);
+    recovery.success(success);
+    recovery.attempt(attempt);
+    recovery.duration(static_cast<uint32_t>(duration.count()));
+    m_od4.send(recovery, cluon::time::now(), m_config.frameId);
+    return success;
+}
+
+bool RadioLink::retryLink()
+{
+    if ( !m_cf || !m_telemetry.hasBlocks() ){
+        return false;
+    }
+    try{
+        m_cf->sendPing();
+        return awaitTelemetry();
+    }
+    catch(std::exception&){
+        return false;
+    }
+}
+
+bool RadioLink::rearmLogBlocks()
+{
+    if ( !m_cf || !m_telemetry.hasBlocks() ){
+        return false;
+    }
+    try{
+        // The TOC and the block layouts on the Crazyflie object are kept,
+        // only the blocks are started again
+        m_telemetry.startBlocks();
+        return awaitTelemetry();
+    }
+    catch(std::exception&){
+        return false;
+    }
+}
+
+bool RadioLink::awaitTelemetry()
+{
+    // Telemetry flowing again is what tells a recovered link from one that
+    // only answers pings
+    std::chrono::milliseconds const timeout{std::max(std::chrono::milliseconds(100), 3 * m_telemetry.fastestPeriod())};
+    auto const start = std::chrono::steady_clock::now();
+    while ( m_telemetry.lastSample() < start && std::chrono::steady_clock::now() - start < timeout ){
+        std::this_thread::sleep_for(m_config.pumpPeriod);
+        m_cf->sendPing();
+    }
+    return m_telemetry.lastSample() >= start;
+}
+
+bool RadioLink::popCommand(bool isEmergency, command &cmd)
+{
+    TraceScope trace(m_log, TraceEvent::Dequeue, m_config.frameId);
+    if ( !(isEmergency ? m_commandQueue.popEmergency(cmd) : m_commandQueue.pop(cmd)) ){
+        return false;
+    }
+    cmd.dequeuedUs = cluon::time::toMicroseconds(cluon::time::now());
+    return true;
+}
+
+void RadioLink::sendCommand(command const &cmd, uint32_t attempt)
+{
+    TraceScope trace(m_log, TraceEvent::CommandSend, m_config.frameId, static_cast<float>(cmd.Type));
+    if ( m_log.isOpen() ){
+        m_log.log(LogEvent::CommandSent, m_config.frameId, {static_cast<float>(cmd.Type), static_cast<float>(attempt)});
+    } else {
+        std::cout << "Received command..." << std::endl;
+    }
+    if ( isSetpointCommand(cmd) ){
+        dispatch(cmd);
+        m_latency.record(cmd, cluon::time::toMicroseconds(cluon::time::now()));
+        return;
+    }
+    // A stop takes the place of a waiting command it stops anyway
+    if ( m_hasRetry && isEmergencyCommand(cmd) && isCoveredBy(m_retry.groupMask, cmd.groupMask) ){
+        m_hasRetry = false;
+        reportStatus(m_retry, CommandState::Failed, m_retryAttempt - 1);
+    }
+    reportStatus(cmd, CommandState::Sent, attempt);
+    try{
+        dispatch(cmd);
+    }
+    catch(std::exception&){
+        if ( isCriticalCommand(cmd) && attempt < m_config.commandAttempts && !isExpired(cmd) ){
+            std::cerr << "Command with type " << cmd.Type << " to frame " << m_config.frameId << " failed in attempt " << attempt << ", sending it again once the link is back." << std::endl;
+            m_retry = cmd;
+            m_retryAttempt = attempt + 1;
+            m_hasRetry = true;
+        } else {
+            reportStatus(cmd, CommandState::Failed, attempt);
+        }
+        throw;
+    }
+    m_latency.record(cmd, cluon::time::toMicroseconds(cluon::time::now()));
+    reportStatus(cmd, CommandState::Acked, attempt);
+}
+
+void RadioLink::retryCommand()
+{
+    m_hasRetry = false;
+    command const cmd{m_retry};
+    if ( isExpired(cmd) ){
+        std::cerr << "Command with type " << cmd.Type << " to frame " << m_config.frameId << " expired before attempt " << m_retryAttempt << "." << std::endl;
+        reportStatus(cmd, CommandState::Failed, m_retryAttempt - 1);
+        return;
+    }
+    sendCommand(cmd, m_retryAttempt);
+}
+
+void RadioLink::reportStatus(command const &cmd, CommandState state, uint32_t attempt)
+{
+    if ( CommandState::Acked == state ){
+        m_linkStatistics[static_cast<uint32_t>(LinkStatistic::Acked)]++;
+    } else if ( CommandState::Failed == state ){
+        m_linkStatistics[static_cast<uint32_t>(LinkStatistic::Failed)]++;
+    } else if ( CommandState::Sent == state && attempt > 1 ){
+        m_linkStatistics[static_cast<uint32_t>(LinkStatistic::Retried)]++;
+    }
+    reportCommandStatus(m_od4, cmd, m_config.frameId, state, attempt);
+}
+
+bool RadioLink::isExpired(command const &cmd) const
+{
+    int64_t const ageUs{cluon::time::toMicroseconds(cluon::time::now()) - cmd.receivedUs};
+    return ageUs > std::chrono::duration_cast<std::chrono::microseconds>(m_config.commandTimeout).count();
+}
+
+void RadioLink::dispatch(command const &cmd)
+{
+    uint8_t group_mask = cmd.groupMask;
+    if ( isSetpointCommand(cmd) ){
+        sendSetpoint(cmd);
+        if ( m_streamer.isEnabled() ){
+            m_isStreaming = true;
+            m_streamSetpoint = cmd;
+            m_streamSetpointTime = std::chrono::steady_clock::now();
+            m_streamedTick = m_streamer.tick();
+        }
+        return;
+    }
+    // The high-level commander takes over
+    stopSetpoints();
+    switch (cmd.Type)
+    {
+        case 0: // Takeoff
+            m_cf->takeoff(cmd.height, cmd.time, group_mask);
+            break;
+        case 1: // Land
+            m_cf->land(cmd.height, cmd.time, group_mask);
+            break;
+        case 2: // Stop
+            m_cf->stop(group_mask);
+            break;
+        case 3: // Goto
+            {
+                bool relative = true;
+                m_cf->goTo(cmd.x, cmd.y, cmd.z, cmd.yaw, cmd.time, relative, group_mask);
+                break;
+            }
+        case 7: // Start trajectory
+            // Commands overtake uploads, but not the one they are about
+            if ( m_hasUploads ){
+                m_packets[static_cast<uint32_t>(TrafficClass::Configuration)] += sendUploads();
+            }
+            if ( m_trajectories.count(cmd.trajectoryId) == 0 ){
+                std::cerr << "Trajectory " << static_cast<uint32_t>(cmd.trajectoryId) << " was not uploaded by this process to frame " << m_config.frameId << ", starting it anyway." << std::endl;
+            }
+            m_cf->startTrajectory(cmd.trajectoryId, cmd.timescale, cmd.reversed, cmd.relative, group_mask);
+            break;
+    }
+}
+
+uint64_t RadioLink::sendUploads()
+{
+    // An upload leaves the queue once it is on the Crazyflie, a failed one
+    // stays in front for the next attempt after the link is recovered
+    uint64_t packets{0};
+    for (;;) {
+        TrajectoryUpload upload;
+        {
+            std::lock_guard<std::mutex> lck(m_uploadsMutex);
+            if ( m_uploads.empty() ){
+                m_hasUploads = false;
+                return packets;
+            }
+            upload = m_uploads.front();
+        }
+        try{
+            packets += sendTrajectory(upload);
+        }
+        catch(std::exception&){
+            bool isDropped{false};
+            {
+                std::lock_guard<std::mutex> lck(m_uploadsMutex);
+                TrajectoryUpload &failed = m_uploads.front();
+                failed.failures++;
+                isDropped = failed.failures >= m_config.commandAttempts;
+                if ( isDropped ){
+                    m_uploads.erase(m_uploads.begin());
+                    m_hasUploads = !m_uploads.empty();
+                }
+            }
+            std::cerr << "Upload of trajectory " << static_cast<uint32_t>(upload.trajectoryId) << " to frame " << m_config.frameId << " failed" << (isDropped ? ", dropping it." : ", trying again after recovery.") << std::endl;
+            reportStatus(upload.request, CommandState::Failed, upload.failures + 1);
+            throw;
+        }
+        reportStatus(upload.request, CommandState::Acked, upload.failures + 1);
+        std::lock_guard<std::mutex> lck(m_uploadsMutex);
+        m_uploads.erase(m_uploads.begin());
+    }
+}
+
+uint64_t RadioLink::sendTrajectory(TrajectoryUpload const &upload)
+{
+    auto const start = std::chrono::steady_clock::now();
+    uint32_t const offset{allocateTrajectory(upload.trajectoryId, static_cast<uint32_t>(upload.pieces.size()))};
+    // The pieces go out as a batch of memory writes, acknowledged as they
+    // come in instead of one round trip per write, then the trajectory is
+    // defined
+    m_cf->uploadTrajectory(upload.trajectoryId, offset, upload.pieces);
+    m_trajectories[upload.trajectoryId] = std::make_pair(offset, static_cast<uint32_t>(upload.pieces.size()));
+    auto const duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    if ( m_log.isOpen() ){
+        m_log.log(LogEvent::TrajectoryUploaded, m_config.frameId, {static_cast<float>(upload.trajectoryId), static_cast<float>(upload.pieces.size()), static_cast<float>(duration.count())});
+    } else if ( m_config.verbose ){
+        std::cout << "Uploaded trajectory " << static_cast<uint32_t>(upload.trajectoryId) << " with " << upload.pieces.size() << " pieces to frame " << m_config.frameId << " in " << duration.count() << " ms." << std::endl;
+    }
+
+    // 24 bytes of memory per write, and the definition
+    uint64_t packets{(upload.pieces.size() * sizeof(Crazyflie::poly4d) + 23) / 24 + 1};
+    if ( upload.start ){
+        stopSetpoints();
+        m_cf->startTrajectory(upload.trajectoryId, upload.timescale, upload.reversed, upload.relative, 0);
+        packets++;
+    }
+    return packets;
+}
+
+uint32_t RadioLink::allocateTrajectory(uint8_t trajectoryId, uint32_t pieces)
+{
+    // A trajectory uploaded again keeps its place if it still fits
+    auto const existing = m_trajectories.find(trajectoryId);
+    if ( existing != m_trajectories.end() && pieces <= existing->second.second ){
+        return existing->second.first;
+    }
+    if ( existing != m_trajectories.end() ){
+        m_trajectories.erase(existing);
+    }
+    uint32_t end{0};
+    for (auto const &trajectory : m_trajectories) {
+        end = std::max(end, trajectory.second.first + trajectory.second.second);
+    }
+    if ( end + pieces > kMaxTrajectoryPieces ){
+        std::cerr << "Trajectory memory of frame " << m_config.frameId << " is full, dropping the other trajectories." << std::endl;
+        m_trajectories.clear();
+        end = 0;
+    }
+    return end;
+}
+
+void RadioLink::streamSetpoint()
+{
+    auto const now = std::chrono::steady_clock::now();
+    uint64_t const tick{m_streamer.tick()};
+    if ( tick > m_streamedTick + 1 ){
+        m_streamStatistics.missed += tick - m_streamedTick - 1;
+    }
+    m_streamedTick = tick;
+    int64_t const delayUs{std::chrono::duration_cast<std::chrono::microseconds>(now - m_streamer.tickTime()).count()};
+    m_streamStatistics.maxDelayUs = std::max(m_streamStatistics.maxDelayUs, delayUs);
+    m_streamStatistics.sumDelayUs += delayUs;
+    m_streamStatistics.sent++;
+
+    command setpoint{m_streamSetpoint};
+    if ( now - m_streamSetpointTime > m_config.setpointTimeout ){
+        m_streamStatistics.stale++;
+        switch (m_config.stalePolicy) {
+            case StalePolicy::Hold:
+                break;
+            case StalePolicy::Hover:
+                setpoint.vx = 0.0f;
+                setpoint.vy = 0.0f;
+                setpoint.vz = 0.0f;
+                setpoint.ax = 0.0f;
+                setpoint.ay = 0.0f;
+                setpoint.az = 0.0f;
+                setpoint.rollRate = 0.0f;
+                setpoint.pitchRate = 0.0f;
+                setpoint.yawRate = 0.0f;
+                break;
+            case StalePolicy::Stop:
+                std::cerr << "Setpoint of frame " << m_config.frameId << " is stale, stopping the motors." << std::endl;
+                // A low-level stop too, the next high-level command hands
+                // the Crazyflie back with stopSetpoints()
+                m_isStreaming = false;
+                m_cf->sendStop();
+                return;
+        }
+    }
+    sendSetpoint(setpoint);
+}
+
+void RadioLink::stopSetpoints()
+{
+    m_isStreaming = false;
+    if ( m_hasSetpoints ){
+        // Nothing of the last setpoint remains valid
+        m_cf->notifySetpointsStop(0);
+        m_hasSetpoints = false;
+    }
+}
+
+void RadioLink::sendSetpoint(command const &cmd)
+{
+    m_hasSetpoints = true;
+    switch (cmd.Type)
+    {
+        case 4: // Hovering
+            m_cf->sendHoverSetpoint(cmd.vx, cmd.vy, cmd.yawRate, cmd.z);
+            break;
+        case 5: // Position
+            m_cf->sendPositionSetpoint(cmd.x, cmd.y, cmd.z, cmd.yaw);
+            break;
+        case 6: // Full state
+            m_cf->sendFullStateSetpoint(cmd.x, cmd.y, cmd.z, cmd.vx, cmd.vy, cmd.vz,
+                cmd.ax, cmd.ay, cmd.az, cmd.qx, cmd.qy, cmd.qz, cmd.qw,
+                cmd.rollRate, cmd.pitchRate, cmd.yawRate);
+            break;
+    }
+    m_lastSetpoint = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIO_LINK_HPP
+#define RADIO_LINK_HPP
+
+#include "cluon-complete.hpp"
+#include "binary-log.hpp"
+#include "command-latency.hpp"
+#include "command-queue.hpp"
+#include "command-status.hpp"
+#include "log-layout.hpp"
+#include "metered-od4-session.hpp"
+#include "setpoint-streamer.hpp"
+#include "telemetry.hpp"
+#include "toc-cache.hpp"
+#include "trajectory.hpp"
+#include "wake-signal.hpp"
+
+#include <crazyflie_cpp/Crazyflie.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct RadioLinkConfig {
+  std::string uri;
+  int16_t frameId;
+  // Incoming packets are pumped at least this often
+  std::chrono::milliseconds pumpPeriod;
+  // Upper bound for the backoff between recovery attempts
+  std::chrono::milliseconds maxBackoff;
+  // The recovery gives up on the link after this long, 0 never gives up
+  std::chrono::milliseconds recoveryTimeout;
+  // Wanted log variables and their rates
+  std::vector<LogGroup> logGroups;
+  // High-level commander groups the drone belongs to, 0 leaves the mask
+  // set on the Crazyflie as it is
+  uint8_t groupMask;
+  // Packets this link may send per scheduling round on a shared radio
+  uint32_t airtimeBudget;
+  // Setpoints are sent at most this often, newer ones replace older ones
+  // in the meantime
+  std::chrono::microseconds setpointPeriod;
+  // A streamed setpoint older than this is stale and handled by the policy
+  std::chrono::milliseconds setpointTimeout;
+  StalePolicy stalePolicy;
+  // Takeoff, land and stop are sent at most this often, and not anymore
+  // once they are older than the timeout
+  uint32_t commandAttempts;
+  std::chrono::milliseconds commandTimeout;
+  bool verbose;
+};
+
+// The kinds of packets a link wants to send, most urgent first.
+enum class TrafficClass : uint8_t {
+  Emergency = 0,
+  Setpoint = 1,
+  // Re-arming log blocks, uploading trajectories
+  Configuration = 2,
+  KeepAlive = 3,
+  None = 4
+};
+constexpr uint32_t kTrafficClassCount{4};
+
+// Counters of a link, read with RadioLink::statistic().
+enum class LinkStatistic : uint32_t {
+  // Log packets received
+  ReceivedPackets = 0,
+  // Commands acknowledged by the Crazyflie, commands that failed for good,
+  // and attempts after the first
+  Acked,
+  Failed,
+  Retried,
+  // Recoveries that brought the link back
+  Reconnects,
+  // Full initializations, including the first, and the time they took
+  Initializations,
+  InitializeUs
+};
+constexpr uint32_t kLinkStatisticCount{7};
+
+struct StreamStatistics {
+  uint64_t sent;
+  // Ticks that passed without a setpoint being sent
+  uint64_t missed;
+  uint64_t stale;
+  // From the tick to the setpoint being sent
+  int64_t maxDelayUs;
+  int64_t sumDelayUs;
+};
+
+// Owns the Crazyflie link of one drone. The link does not have a thread of
+// its own for the radio I/O: the RadioScheduler of its Crazyradio asks it
+// what it wants to send next and lets it send one packet at a time, so that
+// the drones sharing a radio get their fair share of airtime. Commands are
+// handed over through the CommandQueue, incoming packets are pumped with a
+// keepalive when nothing else was sent for a while, and stalled telemetry
+// is re-armed. Trajectories are uploaded as configuration traffic. With a
+// SetpointStreamer running, the latest setpoint is sent again on every tick
+// until a high-level command takes over.
+//
+// The progress of every command but the setpoints is published as
+// CrazyFlieCommandStatus. A takeoff, land or stop that is not acknowledged
+// is sent again once the link is recovered, ahead of the queued commands.
+//
+// The log blocks and the messages published from them are handled by
+// Telemetry.
+//
+// A failing link is recovered in tiers, cheapest first: retry the existing
+// link, re-arm the log blocks on it, and only then rebuild everything. The
+// time spent in each phase is published as CrazyFlieLinkRecovery.
+class RadioLink {
+ private:
+  RadioLink(const RadioLink &) = delete;
+  RadioLink(RadioLink &&) = delete;
+  RadioLink &operator=(const RadioLink &) = delete;
+  RadioLink &operator=(RadioLink &&) = delete;
+
+ public:
+  RadioLink(RadioLinkConfig const &config, MeteredOD4Session &od4,
+      CommandQueue &commandQueue, TocCache &tocCache, WakeSignal &wakeSignal,
+      SetpointStreamer &streamer, BinaryLog &log);
+  ~RadioLink();
+
+  // Connects synchronously, returns false if the Crazyflie is unreachable.
+  bool connect();
+  void start();
+  void stop();
+  // False once the recovery gave up on the link after the recovery timeout.
+  bool isRunning() const noexcept;
+
+  int16_t frameId() const noexcept;
+  uint32_t airtimeBudget() const noexcept;
+  // Changed by relocate().
+  std::string uri() const;
+  // Log packets per second the Crazyflie sends on this link.
+  uint32_t telemetryRate() const noexcept;
+  // May be called from any thread.
+  uint64_t statistic(LinkStatistic statistic) const noexcept;
+  // Latency statistics of the telemetry and of the commands sent on this
+  // link, published with the frameId. May be called from any thread.
+  void publishTelemetryStatistics() const;
+  void printTelemetryStatistics() const;
+  void publishCommandLatency() const;
+  void printCommandLatency() const;
+  // What the link wants to send now, None while it is being recovered.
+  TrafficClass nextTraffic(std::chrono::steady_clock::time_point now) const noexcept;
+  // When the link will want to send something even without new commands.
+  std::chrono::steady_clock::time_point nextDeadline() const noexcept;
+  // Sends one packet of the given class. A failing link is recovered on a
+  // thread of its own, the wake signal is notified once it is done.
+  void transmit(TrafficClass traffic);
+  // Packets sent so far, per class and in total.
+  uint64_t packets(TrafficClass traffic) const noexcept;
+  uint64_t packets() const noexcept;
+  // Only to be read once the link is no longer scheduled.
+  StreamStatistics streamStatistics() const noexcept;
+  // Queues the trajectory for upload, may be called from any thread.
+  void uploadTrajectory(TrajectoryUpload const &upload);
+  // Ends the setpoint stream and hands the Crazyflie back to the high-level
+  // commander as emergency traffic, ahead of a broadcast the link would not
+  // send itself. May be called from any thread.
+  void endSetpoints() noexcept;
+  // Whether endSetpoints() still has to be served, false while recovering.
+  bool isEndingSetpoints() const noexcept;
+  // Moves the link to another radio. The link must not be served by any
+  // scheduler while this is called, it reconnects in the background. A
+  // recovery that is already running picks the new URI up with its next
+  // attempt, so this never waits for the old radio.
+  void relocate(std::string const &uri);
+
+ private:
+  enum RecoveryPhase : uint8_t {
+    RetryLink = 0,
+    RearmLogBlocks = 1,
+    Reinitialize = 2
+  };
+
+  bool initialize();
+  std::chrono::milliseconds stallTimeout() const noexcept;
+  void startRecovery();
+  bool recover();
+  bool retryLink();
+  bool rearmLogBlocks();
+  bool awaitTelemetry();
+  bool runRecoveryPhase(RecoveryPhase phase, uint32_t attempt, bool (RadioLink::*step)());
+  // Takes the next emergency or any command from the queue.
+  bool popCommand(bool isEmergency, command &cmd);
+  // Reports the progress and latency of the command and keeps a critical
+  // one that fails for another attempt.
+  void sendCommand(command const &cmd, uint32_t attempt);
+  void retryCommand();
+  void reportStatus(command const &cmd, CommandState state, uint32_t attempt);
+  bool isExpired(command const &cmd) const;
+  void dispatch(command const &cmd);
+  void streamSetpoint();
+  // Both return the number of packets sent
+  uint64_t sendUploads();
+  uint64_t sendTrajectory(TrajectoryUpload const &upload);
+  uint32_t allocateTrajectory(uint8_t trajectoryId, uint32_t pieces);
+  void sendSetpoint(command const &cmd);
+  // Ends the stream and hands the Crazyflie from the low-level setpoints
+  // back to the high-level commander, which it ignores until the setpoint
+  // watchdog expires otherwise. Called before any high-level packet.
+  void stopSetpoints();
+
+  RadioLinkConfig const m_config;
+  MeteredOD4Session &m_od4;
+  CommandQueue &m_commandQueue;
+  TocCache &m_tocCache;
+  WakeSignal &m_wakeSignal;
+  SetpointStreamer &m_streamer;
+  CommandLatency m_latency;
+  BinaryLog &m_log;
+
+  // Guards m_uri and the end of a recovery against relocate()
+  mutable std::mutex m_uriMutex;
+  std::string m_uri;
+  // Set by relocate() until the recovery switches to the new URI
+  std::atomic<bool> m_isRelocated;
+  std::unique_ptr<Crazyflie> m_cf;
+  Telemetry m_telemetry;
+  std::chrono::steady_clock::time_point m_lastPacket;
+  std::chrono::steady_clock::time_point m_lastRearm;
+  std::array<std::atomic<uint64_t>, kTrafficClassCount> m_packets;
+
+  std::chrono::steady_clock::time_point m_lastSetpoint;
+  bool m_isStreaming;
+  // A low-level setpoint was sent since the last stopSetpoints()
+  bool m_hasSetpoints;
+  std::atomic<bool> m_isEndingSetpoints;
+  command m_streamSetpoint;
+  std::chrono::steady_clock::time_point m_streamSetpointTime;
+  uint64_t m_streamedTick;
+  StreamStatistics m_streamStatistics;
+
+  std::mutex m_uploadsMutex;
+  std::vector<TrajectoryUpload> m_uploads;
+  std::atomic<bool> m_hasUploads;
+  // Offset and number of pieces of every trajectory in the trajectory memory
+  std::map<uint8_t, std::pair<uint32_t, uint32_t>> m_trajectories;
+
+  // Critical command waiting for its next attempt
+  bool m_hasRetry;
+  command m_retry;
+  uint32_t m_retryAttempt;
+
+  std::array<std::atomic<uint64_t>, kLinkStatisticCount> m_linkStatistics;
+
+  std::atomic<bool> m_running;
+  std::atomic<bool> m_recovering;
+  std::thread m_recoveryThread;
+};
+
+#endif
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "radio-pool.hpp"
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+namespace {
+std::string readAttribute(std::string const &device, std::string const &attribute)
+{
+    std::ifstream file("/sys/bus/usb/devices/" + device + "/" + attribute);
+    std::string value;
+    file >> value;
+    return value;
+}
+}
+
+uint32_t countCrazyradios()
+{
+    uint32_t radios{0};
+    DIR *devices{opendir("/sys/bus/usb/devices")};
+    if ( nullptr == devices ){
+        return radios;
+    }
+    while (struct dirent *entry = readdir(devices)) {
+        std::string const device{entry->d_name};
+        // Interfaces ("1-1:1.0") carry no ids
+        if ( device[0] == '.' || device.find(':') != std::string::npos ){
+            continue;
+        }
+        if ( readAttribute(device, "idVendor") == "1915" && readAttribute(device, "idProduct") == "7777" ){
+            radios++;
+        }
+    }
+    closedir(devices);
+    return radios;
+}
+
+RadioPool::RadioPool(RadioPoolConfig const &config, WakeSignal &wakeSignal,
+    SwarmBroadcaster &broadcaster)
+  : m_config(config)
+  , m_wakeSignal(wakeSignal)
+  , m_broadcaster(broadcaster)
+  , m_schedulers()
+  , m_members()
+  , m_radios(0)
+  , m_nextRadio(0)
+  , m_running(false)
+  , m_thread()
+{
+    if ( m_config.shard ){
+        m_radios = countCrazyradios();
+        std::cout << "Found " << m_radios << " Crazyradio(s)." << std::endl;
+    }
+}
+
+RadioPool::~RadioPool()
+{
+    stop();
+}
+
+std::string RadioPool::assign(std::string const &uri)
+{
+    if ( !m_config.shard || 0 == m_radios ){
+        return uri;
+    }
+    return withRadio(uri, m_nextRadio++ % m_radios);
+}
+
+void RadioPool::add(RadioLink &link)
+{
+    scheduler(radioOf(link.uri())).add(link);
+    m_members.push_back(Member{&link, 0, 0, 0.0});
+    if ( !m_config.shard ){
+        m_radios = static_cast<uint32_t>(m_schedulers.size());
+    }
+}
+
+void RadioPool::start()
+{
+    m_running = true;
+    for (auto &scheduler : m_schedulers) {
+        scheduler.second->start();
+    }
+    if ( m_config.shard ){
+        m_thread = std::thread(&RadioPool::run, this);
+    }
+}
+
+void RadioPool::stop()
+{
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    for (auto &scheduler : m_schedulers) {
+        scheduler.second->stop();
+    }
+}
+
+uint32_t RadioPool::radioCount() const noexcept
+{
+    return m_radios;
+}
+
+void RadioPool::run()
+{
+    auto lastMeasurement = std::chrono::steady_clock::now();
+    for (auto &member : m_members) {
+        member.packets = member.link->packets();
+        member.keepAlives = member.link->packets(TrafficClass::KeepAlive);
+    }
+    while (m_running) {
+        auto const nextMeasurement = lastMeasurement + m_config.balancePeriod;
+        while (m_running && std::chrono::steady_clock::now() < nextMeasurement) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        auto const now = std::chrono::steady_clock::now();
+        measure(std::chrono::duration<double>(now - lastMeasurement).count());
+        lastMeasurement = now;
+
+        uint32_t const radios{countCrazyradios()};
+        if ( 0 == radios ){
+            std::cerr << "No Crazyradio attached, keeping the links where they are." << std::endl;
+        } else if ( radios != m_radios ){
+            reshard(radios);
+        } else {
+            rebalance();
+        }
+    }
+}
+
+void RadioPool::measure(double seconds)
+{
+    for (auto &member : m_members) {
+        uint64_t const packets{member.link->packets()};
+        uint64_t const keepAlives{member.link->packets(TrafficClass::KeepAlive)};
+        double const sent{static_cast<double>((packets - member.packets) - (keepAlives - member.keepAlives))};
+        member.load = sent / seconds + member.link->telemetryRate();
+        member.packets = packets;
+        member.keepAlives = keepAlives;
+    }
+}
+
+void RadioPool::rebalance()
+{
+    std::vector<double> const loads{radioLoads()};
+    uint32_t const busiest{static_cast<uint32_t>(std::max_element(loads.begin(), loads.end()) - loads.begin())};
+    uint32_t const idlest{static_cast<uint32_t>(std::min_element(loads.begin(), loads.end()) - loads.begin())};
+    if ( loads.empty() || loads[busiest] <= m_config.capacity || busiest == idlest ){
+        return;
+    }
+
+    // The lightest link is the cheapest to reconnect and the most likely to
+    // fit somewhere else
+    Member *lightest{nullptr};
+    for (auto &member : m_members) {
+        if ( member.link->isRunning() && radioOf(member.link->uri()) == withRadio("radio://", busiest)
+            && (nullptr == lightest || member.load < lightest->load) ){
+            lightest = &member;
+        }
+    }
+    if ( nullptr == lightest ){
+        return;
+    }
+    if ( loads[idlest] + lightest->load > m_config.capacity ){
+        std::cerr << withRadio("radio://", busiest) << " is saturated with " << static_cast<uint32_t>(loads[busiest]) << " packets/s, but no other radio has room for frame " << lightest->link->frameId() << "." << std::endl;
+        return;
+    }
+    move(*lightest, withRadio(lightest->link->uri(), idlest));
+}
+
+void RadioPool::reshard(uint32_t radios)
+{
+    std::cout << "Crazyradios changed from " << m_radios << " to " << radios << ", dealing out the links again." << std::endl;
+    m_radios = radios;
+
+    // Heaviest first onto the least loaded radio
+    std::vector<Member *> members;
+    for (auto &member : m_members) {
+        members.push_back(&member);
+    }
+    std::stable_sort(members.begin(), members.end(), [](Member const *a, Member const *b) {
+        return a->load > b->load;
+    });
+    std::vector<double> loads(radios, 0.0);
+    for (auto member : members) {
+        uint32_t const radio{static_cast<uint32_t>(std::min_element(loads.begin(), loads.end()) - loads.begin())};
+        loads[radio] += member->load;
+        std::string const uri{withRadio(member->link->uri(), radio)};
+        if ( member->link->isRunning() && uri != member->link->uri() ){
+            move(*member, uri);
+        }
+    }
+
+    // Radios that are gone or no longer used
+    for (auto it = m_schedulers.begin(); it != m_schedulers.end();) {
+        bool const isUsed{std::any_of(m_members.begin(), m_members.end(), [&it](Member const &member) {
+            return radioOf(member.link->uri()) == it->first;
+        })};
+        if ( isUsed ){
+            ++it;
+        } else {
+            it->second->stop();
+            it = m_schedulers.erase(it);
+        }
+    }
+}
+
+void RadioPool::move(Member &member, std::string const &uri)
+{
+    // The old scheduler is done with the link once remove() returns
+    scheduler(radioOf(member.link->uri())).remove(*member.link);
+    member.link->relocate(uri);
+    scheduler(radioOf(uri)).add(*member.link);
+}
+
+RadioScheduler &RadioPool::scheduler(std::string const &radio)
+{
+    std::unique_ptr<RadioScheduler> &scheduler = m_schedulers[radio];
+    if ( !scheduler ){
+        scheduler.reset(new RadioScheduler(radio, m_wakeSignal, m_broadcaster, m_config.reportPeriod));
+        if ( m_running ){
+            scheduler->start();
+        }
+    }
+    return *scheduler;
+}
+
+std::vector<double> RadioPool::radioLoads() const
+{
+    std::vector<double> loads(m_radios, 0.0);
+    for (auto const &member : m_members) {
+        std::string const radio{radioOf(member.link->uri())};
+        for (uint32_t i{0}; i < loads.size(); i++) {
+            if ( radio == withRadio("radio://", i) ){
+                loads[i] += member.load;
+            }
+        }
+    }
+    return loads;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIO_POOL_HPP
+#define RADIO_POOL_HPP
+
+#include "radio-link.hpp"
+#include "radio-scheduler.hpp"
+#include "swarm-broadcaster.hpp"
+#include "wake-signal.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Number of Crazyradios attached over USB, as listed in sysfs.
+uint32_t countCrazyradios();
+
+struct RadioPoolConfig {
+  // Spread the links over all attached Crazyradios instead of using the
+  // radio given in their URI
+  bool shard;
+  // Packets per second a radio is considered to handle
+  uint32_t capacity;
+  // How often the load is measured and the radios are looked for
+  std::chrono::seconds balancePeriod;
+  std::chrono::seconds reportPeriod;
+};
+
+// Runs one RadioScheduler per Crazyradio in use. When sharding, the links
+// are spread over all attached radios by load: the load of a link is the
+// commands and log configuration it sent plus the telemetry the Crazyflie
+// sends back, in packets per second, keepalives only fill spare airtime and
+// do not count. A radio going above its capacity hands its lightest link to
+// the least loaded radio that has room for it, one link per balance period.
+// When radios are plugged in or removed all links are dealt out again.
+class RadioPool {
+ private:
+  RadioPool(const RadioPool &) = delete;
+  RadioPool(RadioPool &&) = delete;
+  RadioPool &operator=(const RadioPool &) = delete;
+  RadioPool &operator=(RadioPool &&) = delete;
+
+ public:
+  RadioPool(RadioPoolConfig const &config, WakeSignal &wakeSignal,
+      SwarmBroadcaster &broadcaster);
+  ~RadioPool();
+
+  // The URI a new link should use, when sharding its radio is picked round
+  // robin as nothing has been measured yet.
+  std::string assign(std::string const &uri);
+  // Links must be added before start().
+  void add(RadioLink &link);
+  void start();
+  void stop();
+  uint32_t radioCount() const noexcept;
+
+ private:
+  struct Member {
+    RadioLink *link;
+    uint64_t packets;
+    uint64_t keepAlives;
+    double load;
+  };
+
+  void run();
+  void measure(double seconds);
+  void rebalance();
+  void reshard(uint32_t radios);
+  void move(Member &member, std::string const &uri);
+  RadioScheduler &scheduler(std::string const &radio);
+  // Indexed by radio
+  std::vector<double> radioLoads() const;
+
+  RadioPoolConfig const m_config;
+  WakeSignal &m_wakeSignal;
+  SwarmBroadcaster &m_broadcaster;
+
+  std::map<std::string, std::unique_ptr<RadioScheduler>> m_schedulers;
+  std::vector<Member> m_members;
+  std::atomic<uint32_t> m_radios;
+  uint32_t m_nextRadio;
+
+  std::atomic<bool> m_running;
+  std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "radio-scheduler.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+std::string radioOf(std::string const &uri)
+{
+    std::string const scheme{"radio://"};
+    if ( uri.compare(0, scheme.size(), scheme) != 0 ){
+        return uri;
+    }
+    return uri.substr(0, uri.find('/', scheme.size()));
+}
+
+std::string withRadio(std::string const &uri, uint32_t radio)
+{
+    std::string const scheme{"radio://"};
+    if ( uri.compare(0, scheme.size(), scheme) != 0 ){
+        return uri;
+    }
+    std::string::size_type const end{uri.find('/', scheme.size())};
+    return scheme + std::to_string(radio) + ((end == std::string::npos) ? "" : uri.substr(end));
+}
+
+RadioScheduler::RadioScheduler(std::string const &radio, WakeSignal &wakeSignal,
+    SwarmBroadcaster &broadcaster, std::chrono::seconds reportPeriod)
+  : m_radio(radio)
+  , m_wakeSignal(wakeSignal)
+  , m_broadcaster(broadcaster)
+  , m_reportPeriod(reportPeriod)
+  , m_slotsMutex()
+  , m_slots()
+  , m_firstSlot(0)
+  , m_running(false)
+  , m_thread()
+{
+}
+
+RadioScheduler::~RadioScheduler()
+{
+    stop();
+}
+
+std::string const &RadioScheduler::radio() const noexcept
+{
+    return m_radio;
+}
+
+void RadioScheduler::add(RadioLink &link)
+{
+    std::lock_guard<std::mutex> lck(m_slotsMutex);
+    m_slots.push_back(Slot{&link, link.packets()});
+}
+
+void RadioScheduler::remove(RadioLink &link)
+{
+    std::lock_guard<std::mutex> lck(m_slotsMutex);
+    m_slots.erase(std::remove_if(m_slots.begin(), m_slots.end(), [&link](Slot const &slot) {
+        return slot.link == &link;
+    }), m_slots.end());
+}
+
+void RadioScheduler::start()
+{
+    m_running = true;
+    m_thread = std::thread(&RadioScheduler::run, this);
+}
+
+void RadioScheduler::stop()
+{
+    m_running = false;
+    m_wakeSignal.notify();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void RadioScheduler::run()
+{
+    auto nextReport = std::chrono::steady_clock::now() + m_reportPeriod;
+    while (m_running) {
+        // Read before looking at the links, a command arriving during the
+        // round then keeps the wait below from sleeping
+        uint64_t const generation{m_wakeSignal.generation()};
+        std::unique_lock<std::mutex> lck(m_slotsMutex);
+        bool hasSent{serveEmergencies()};
+        hasSent |= m_broadcaster.transmit(m_radio, false);
+
+        for (size_t i{0}; i < m_slots.size(); i++) {
+            RadioLink &link = *m_slots[(m_firstSlot + i) % m_slots.size()].link;
+            for (uint32_t budget{link.airtimeBudget()}; budget > 0; budget--) {
+                TrafficClass const traffic{link.nextTraffic(std::chrono::steady_clock::now())};
+                if ( TrafficClass::None == traffic ){
+                    break;
+                }
+                link.transmit(traffic);
+                hasSent = true;
+                hasSent |= serveEmergencies();
+            }
+        }
+        // The link that went first goes last in the next round
+        if ( !m_slots.empty() ){
+            m_firstSlot = (m_firstSlot + 1) % m_slots.size();
+        }
+
+        auto const now = std::chrono::steady_clock::now();
+        if ( m_reportPeriod.count() > 0 && now >= nextReport ){
+            // A radio of its own needs no share
+            if ( m_slots.size() > 1 ){
+                reportAirtime();
+            }
+            nextReport = now + m_reportPeriod;
+        }
+        auto const deadline = std::min(nextDeadline(), nextReport);
+        lck.unlock();
+        if ( !hasSent ){
+            m_wakeSignal.waitUntil(generation, deadline);
+        }
+    }
+}
+
+bool RadioScheduler::serveEmergencies()
+{
+    bool hasSent{m_broadcaster.transmit(m_radio, true)};
+    for (auto &slot : m_slots) {
+        if ( TrafficClass::Emergency == slot.link->nextTraffic(std::chrono::steady_clock::now()) ){
+            slot.link->transmit(TrafficClass::Emergency);
+            hasSent = true;
+        }
+    }
+    return hasSent;
+}
+
+std::chrono::steady_clock::time_point RadioScheduler::nextDeadline() const noexcept
+{
+    // Recovering links have no deadline, do not wait for them unbounded
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+    if ( m_radio.compare(0, 8, "radio://") == 0 ){
+        deadline = std::min(deadline, m_broadcaster.nextDeadline());
+    }
+    for (auto const &slot : m_slots) {
+        deadline = std::min(deadline, slot.link->nextDeadline());
+    }
+    return deadline;
+}
+
+void RadioScheduler::reportAirtime()
+{
+    uint64_t total{0};
+    for (auto const &slot : m_slots) {
+        total += slot.link->packets() - slot.reportedPackets;
+    }
+    std::cout << "Airtime on " << m_radio << " (" << total / static_cast<uint64_t>(m_reportPeriod.count()) << " packets/s):";
+    for (auto &slot : m_slots) {
+        uint64_t const packets{slot.link->packets()};
+        double const share{(total > 0) ? 100.0 * static_cast<double>(packets - slot.reportedPackets) / static_cast<double>(total) : 0.0};
+        std::cout << " frame " << slot.link->frameId() << " " << std::fixed << std::setprecision(1) << share << "%";
+        slot.reportedPackets = packets;
+    }
+    std::cout << std::endl;
+}
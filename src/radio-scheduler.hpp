@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIO_SCHEDULER_HPP
+#define RADIO_SCHEDULER_HPP
+
+#include "radio-link.hpp"
+#include "swarm-broadcaster.hpp"
+#include "wake-signal.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The radio a link URI goes through, "radio://0/80/2M/E7E7E7E7E7" is sent
+// by "radio://0". Other URIs are their own radio.
+std::string radioOf(std::string const &uri);
+// The same link on the radio with the given index.
+std::string withRadio(std::string const &uri, uint32_t radio);
+
+// Shares the airtime of one Crazyradio between the links of the drones it
+// serves, on a single radio I/O thread. Every round, each link may send up
+// to its airtime budget in packets, most urgent first, and the link that
+// starts the round rotates. Emergency stops of any link are sent before
+// anything else, also in the middle of another link's turn. Pending swarm
+// broadcasts are sent at the start of a round, or right away for a stop.
+//
+// The share of the packets every drone got is printed each report period.
+class RadioScheduler {
+ private:
+  RadioScheduler(const RadioScheduler &) = delete;
+  RadioScheduler(RadioScheduler &&) = delete;
+  RadioScheduler &operator=(const RadioScheduler &) = delete;
+  RadioScheduler &operator=(RadioScheduler &&) = delete;
+
+ public:
+  // A report period of zero disables the airtime report.
+  RadioScheduler(std::string const &radio, WakeSignal &wakeSignal,
+      SwarmBroadcaster &broadcaster, std::chrono::seconds reportPeriod);
+  ~RadioScheduler();
+
+  std::string const &radio() const noexcept;
+  // Links can be added and removed while the scheduler runs, removing waits
+  // for the round in progress.
+  void add(RadioLink &link);
+  void remove(RadioLink &link);
+  void start();
+  void stop();
+
+ private:
+  struct Slot {
+    RadioLink *link;
+    uint64_t reportedPackets;
+  };
+
+  void run();
+  bool serveEmergencies();
+  std::chrono::steady_clock::time_point nextDeadline() const noexcept;
+  void reportAirtime();
+
+  std::string const m_radio;
+  WakeSignal &m_wakeSignal;
+  SwarmBroadcaster &m_broadcaster;
+  std::chrono::seconds const m_reportPeriod;
+
+  std::mutex m_slotsMutex;
+  std::vector<Slot> m_slots;
+  size_t m_firstSlot;
+
+  std::atomic<bool> m_running;
+  std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "setpoint-streamer.hpp"
+
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+StalePolicy toStalePolicy(std::string const &name)
+{
+    if ( name == "hold" ){
+        return StalePolicy::Hold;
+    }
+    if ( name == "hover" ){
+        return StalePolicy::Hover;
+    }
+    if ( name == "stop" ){
+        return StalePolicy::Stop;
+    }
+    throw std::runtime_error("Unknown stale setpoint policy '" + name + "', expected hold, hover or stop");
+}
+
+SetpointStreamer::SetpointStreamer(float rate, int32_t priority, WakeSignal &wakeSignal)
+  : m_period((rate > 0.0f) ? static_cast<int64_t>(1e9f / rate) : 0)
+  , m_priority(priority)
+  , m_wakeSignal(wakeSignal)
+  , m_timerFd(-1)
+  , m_tick(0)
+  , m_tickTimeNs(0)
+  , m_overruns(0)
+  , m_maxJitterNs(0)
+  , m_sumJitterNs(0)
+  , m_running(false)
+  , m_thread()
+{
+}
+
+SetpointStreamer::~SetpointStreamer()
+{
+    stop();
+}
+
+bool SetpointStreamer::isEnabled() const noexcept
+{
+    return m_period.count() > 0;
+}
+
+void SetpointStreamer::start()
+{
+    if ( !isEnabled() ){
+        return;
+    }
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if ( m_timerFd < 0 ){
+        throw std::runtime_error(std::string("Could not create the setpoint timer: ") + std::strerror(errno));
+    }
+    struct itimerspec spec{};
+    spec.it_interval.tv_sec = static_cast<time_t>(m_period.count() / 1000000000);
+    spec.it_interval.tv_nsec = static_cast<long>(m_period.count() % 1000000000);
+    spec.it_value = spec.it_interval;
+    if ( timerfd_settime(m_timerFd, 0, &spec, nullptr) != 0 ){
+        close(m_timerFd);
+        m_timerFd = -1;
+        throw std::runtime_error(std::string("Could not start the setpoint timer: ") + std::strerror(errno));
+    }
+
+    m_running = true;
+    m_thread = std::thread(&SetpointStreamer::run, this);
+    if ( m_priority > 0 ){
+        struct sched_param param{};
+        param.sched_priority = m_priority;
+        int const error{pthread_setschedparam(m_thread.native_handle(), SCHED_FIFO, &param)};
+        if ( error != 0 ){
+            std::cerr << "Could not run the setpoint stream with real-time priority " << m_priority << ": " << std::strerror(error) << std::endl;
+        }
+    }
+}
+
+void SetpointStreamer::stop()
+{
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    if ( m_timerFd >= 0 ){
+        close(m_timerFd);
+        m_timerFd = -1;
+    }
+}
+
+uint64_t SetpointStreamer::tick() const noexcept
+{
+    return m_tick;
+}
+
+std::chrono::steady_clock::time_point SetpointStreamer::tickTime() const noexcept
+{
+    return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(m_tickTimeNs.load()));
+}
+
+void SetpointStreamer::printStatistics() const
+{
+    if ( !isEnabled() ){
+        return;
+    }
+    uint64_t const ticks{m_tick};
+    int64_t const wakeUps{static_cast<int64_t>(ticks - m_overruns)};
+    std::cout << "Setpoint stream: " << ticks << " ticks every " << m_period.count() / 1000 << " us, " << m_overruns << " overrun(s), jitter mean " << ((wakeUps > 0) ? m_sumJitterNs / wakeUps / 1000 : 0) << " us, max " << m_maxJitterNs / 1000 << " us." << std::endl;
+}
+
+void SetpointStreamer::run()
+{
+    std::chrono::steady_clock::time_point expected;
+    struct pollfd timer{m_timerFd, POLLIN, 0};
+    while (m_running) {
+        // Wake up now and then to notice stop() at low rates
+        if ( poll(&timer, 1, 100) <= 0 ){
+            continue;
+        }
+        uint64_t expirations{0};
+        if ( read(m_timerFd, &expirations, sizeof(expirations)) != sizeof(expirations) || 0 == expirations ){
+            continue;
+        }
+        auto const now = std::chrono::steady_clock::now();
+        // Expirations beyond the first were missed while this thread did not run
+        m_overruns += expirations - 1;
+        // The first tick sets the pace
+        if ( 0 == m_tick ){
+            expected = now;
+        } else {
+            expected += static_cast<int64_t>(expirations) * m_period;
+        }
+        int64_t const jitterNs{std::chrono::duration_cast<std::chrono::nanoseconds>(now - expected).count()};
+        m_maxJitterNs = std::max(m_maxJitterNs, jitterNs);
+        m_sumJitterNs += std::max(jitterNs, int64_t{0});
+
+        m_tickTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+        m_tick += expirations;
+        m_wakeSignal.notify();
+    }
+}
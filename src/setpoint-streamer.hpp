@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SETPOINT_STREAMER_HPP
+#define SETPOINT_STREAMER_HPP
+
+#include "wake-signal.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+// What a streaming link sends once no new setpoint arrived for a while.
+enum class StalePolicy : uint8_t {
+  // Keep sending the latest setpoint
+  Hold,
+  // Keep the height, but no longer move
+  Hover,
+  // Cut the motors and stop streaming
+  Stop
+};
+
+// Parses "hold", "hover" or "stop", throws std::runtime_error otherwise.
+StalePolicy toStalePolicy(std::string const &name);
+
+// The Crazyflie expects low-level setpoints to be streamed and falls back
+// when they do not arrive in time, no matter how irregular the planner
+// sending them is. A timerfd drives the stream at a fixed rate: every tick
+// makes the streaming links send their latest setpoint again, through the
+// scheduler of their radio. How late the ticks come and how many are lost
+// is kept as statistics.
+class SetpointStreamer {
+ private:
+  SetpointStreamer(const SetpointStreamer &) = delete;
+  SetpointStreamer(SetpointStreamer &&) = delete;
+  SetpointStreamer &operator=(const SetpointStreamer &) = delete;
+  SetpointStreamer &operator=(SetpointStreamer &&) = delete;
+
+ public:
+  // A rate of zero disables streaming. A priority above zero runs the timer
+  // thread with SCHED_FIFO at that priority, if the process may do so.
+  SetpointStreamer(float rate, int32_t priority, WakeSignal &wakeSignal);
+  ~SetpointStreamer();
+
+  bool isEnabled() const noexcept;
+  // Throws std::runtime_error if the timer cannot be set up.
+  void start();
+  void stop();
+
+  // Counts the ticks since start().
+  uint64_t tick() const noexcept;
+  std::chrono::steady_clock::time_point tickTime() const noexcept;
+  void printStatistics() const;
+
+ private:
+  void run();
+
+  std::chrono::nanoseconds const m_period;
+  int32_t const m_priority;
+  WakeSignal &m_wakeSignal;
+
+  int m_timerFd;
+  std::atomic<uint64_t> m_tick;
+  std::atomic<int64_t> m_tickTimeNs;
+  // Timer thread only, read once it is stopped
+  uint64_t m_overruns;
+  int64_t m_maxJitterNs;
+  int64_t m_sumJitterNs;
+
+  std::atomic<bool> m_running;
+  std::thread m_thread;
+};
+
+#endif
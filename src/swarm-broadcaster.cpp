@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "swarm-broadcaster.hpp"
+#include "command-status.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+// Crazyflies listen for broadcasts on this address
+char const *const kBroadcastAddress{"FFE7E7E7E7"};
+
+struct RadioAddress {
+  // Channel and data rate, as in "80/2M"
+  std::string channel;
+  // Last byte of the radio address
+  uint8_t id;
+};
+
+bool isNumber(std::string const &text, int (*isDigit)(int))
+{
+    return !text.empty() && std::all_of(text.begin(), text.end(), [isDigit](char c) { return 0 != isDigit(static_cast<unsigned char>(c)); });
+}
+
+// Splits radio://0/80/2M/E7E7E7E701 into the channel "80/2M" and the id 1,
+// a link without address has the default one ending in E7. Throws
+// std::runtime_error if the channel or data rate is missing or the address
+// is no 5 byte hex number.
+RadioAddress parseRadioUri(std::string const &uri)
+{
+    std::string const scheme{"radio://"};
+    std::string const path{uri.substr(scheme.size(), uri.find('?') - scheme.size())};
+    std::stringstream stream(path);
+    std::vector<std::string> parts;
+    std::string part;
+    while (std::getline(stream, part, '/')) {
+        parts.push_back(part);
+    }
+    if ( parts.size() < 3 || !isNumber(parts[1], std::isdigit) || parts[2].empty() ){
+        throw std::runtime_error("Radio link " + uri + " has no channel and data rate, expected radio://<radio>/<channel>/<data rate>[/<address>]");
+    }
+    RadioAddress address{parts[1] + "/" + parts[2], 0xE7};
+    if ( parts.size() > 3 && !parts[3].empty() ){
+        if ( parts[3].size() != 10 || !isNumber(parts[3], std::isxdigit) ){
+            throw std::runtime_error("Radio link " + uri + " has an invalid address, expected 10 hex digits");
+        }
+        address.id = static_cast<uint8_t>(std::stoul(parts[3].substr(8), nullptr, 16));
+    }
+    return address;
+}
+}
+
+SwarmBroadcaster::SwarmBroadcaster(uint32_t capacity, WakeSignal &wakeSignal,
+    MeteredOD4Session &od4, CommandLatency &latency, BinaryLog &log,
+    uint32_t criticalRepeats, float poseRate, bool hasOrientation)
+  : m_queue(capacity, wakeSignal)
+  , m_isHeld()
+  , m_od4(od4)
+  , m_latency(latency)
+  , m_log(log)
+  , m_criticalRepeats(std::max(criticalRepeats, 1u))
+  , m_channels()
+  , m_sendMutex()
+  , m_broadcasters()
+  , m_wakeSignal(wakeSignal)
+  , m_posePeriod((poseRate > 0.0f) ? static_cast<int64_t>(1e9f / poseRate) : 0)
+  , m_hasOrientation(hasOrientation)
+  , m_targets()
+  , m_posesMutex()
+  , m_poses()
+  , m_hasPoses(false)
+  , m_nextPosesNs(0)
+{
+    m_queue.onSuperseded([this](command const &cmd) {
+        reportCommandStatus(m_od4, cmd, kBroadcastFrameId, CommandState::Failed, 0);
+    });
+}
+
+void SwarmBroadcaster::addChannel(int16_t frameId, std::string const &uri)
+{
+    if ( uri.compare(0, 8, "radio://") != 0 ){
+        std::cerr << "Link " << uri << " is not on a radio channel, it does not get broadcasts." << std::endl;
+        return;
+    }
+    RadioAddress const address{parseRadioUri(uri)};
+    if ( std::find(m_channels.begin(), m_channels.end(), address.channel) == m_channels.end() ){
+        m_channels.push_back(address.channel);
+    }
+    m_targets[frameId] = PoseTarget{address.channel, address.id};
+}
+
+void SwarmBroadcaster::holdWhile(std::function<bool()> isHeld)
+{
+    m_isHeld = isHeld;
+}
+
+bool SwarmBroadcaster::push(command const &cmd) noexcept
+{
+    return m_queue.push(cmd);
+}
+
+void SwarmBroadcaster::updatePose(int16_t frameId, float x, float y, float z,
+    float roll, float pitch, float yaw)
+{
+    auto const target = m_targets.find(frameId);
+    if ( 0 == m_posePeriod.count() || target == m_targets.end() ){
+        return;
+    }
+    // Z-Y-X Euler angles to a quaternion
+    float const cr{std::cos(roll / 2.0f)};
+    float const sr{std::sin(roll / 2.0f)};
+    float const cp{std::cos(pitch / 2.0f)};
+    float const sp{std::sin(pitch / 2.0f)};
+    float const cy{std::cos(yaw / 2.0f)};
+    float const sy{std::sin(yaw / 2.0f)};
+    CrazyflieBroadcaster::externalPose pose;
+    pose.id = target->second.id;
+    pose.x = x;
+    pose.y = y;
+    pose.z = z;
+    pose.qx = sr * cp * cy - cr * sp * sy;
+    pose.qy = cr * sp * cy + sr * cp * sy;
+    pose.qz = cr * cp * sy - sr * sp * cy;
+    pose.qw = cr * cp * cy + sr * sp * sy;
+    {
+        std::lock_guard<std::mutex> lck(m_posesMutex);
+        m_poses[target->second.channel][pose.id] = pose;
+        m_hasPoses = true;
+    }
+    m_wakeSignal.notify();
+}
+
+bool SwarmBroadcaster::transmit(std::string const &radio, bool stopOnly)
+{
+    bool const hasCommand{(stopOnly ? m_queue.hasEmergency() : !m_queue.empty()) && !(m_isHeld && m_isHeld())};
+    bool const hasPoses{!stopOnly && m_hasPoses && std::chrono::steady_clock::now() >= nextDeadline()};
+    if ( (!hasCommand && !hasPoses) || radio.compare(0, 8, "radio://") != 0 ){
+        return false;
+    }
+    std::unique_lock<std::mutex> lck(m_sendMutex, std::try_to_lock);
+    if ( !lck.owns_lock() ){
+        return false;
+    }
+    command cmd;
+    if ( hasCommand && (stopOnly ? m_queue.popEmergency(cmd) : m_queue.pop(cmd)) ){
+        cmd.dequeuedUs = cluon::time::toMicroseconds(cluon::time::now());
+        send(radio, cmd);
+        return true;
+    }
+    if ( hasPoses && std::chrono::steady_clock::now() >= nextDeadline() ){
+        sendPoses(radio);
+        return true;
+    }
+    return false;
+}
+
+std::chrono::steady_clock::time_point SwarmBroadcaster::nextDeadline() const noexcept
+{
+    if ( !m_hasPoses ){
+        return std::chrono::steady_clock::time_point::max();
+    }
+    return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(m_nextPosesNs.load()));
+}
+
+uint64_t SwarmBroadcaster::dropped() const noexcept
+{
+    return m_queue.dropped();
+}
+
+CrazyflieBroadcaster &SwarmBroadcaster::broadcaster(std::string const &uri)
+{
+    std::unique_ptr<CrazyflieBroadcaster> &broadcaster = m_broadcasters[uri];
+    if ( !broadcaster ){
+        broadcaster.reset(new CrazyflieBroadcaster(uri));
+    }
+    return *broadcaster;
+}
+
+void SwarmBroadcaster::send(std::string const &radio, command const &cmd)
+{
+    uint32_t const repeats{isCriticalCommand(cmd) ? m_criticalRepeats : 1};
+    if ( m_log.isOpen() ){
+        m_log.log(LogEvent::CommandSent, kBroadcastFrameId, {static_cast<float>(cmd.Type), static_cast<float>(repeats)});
+    } else {
+        std::cout << "Broadcasting command with type " << cmd.Type << " to group mask " << static_cast<uint32_t>(cmd.groupMask) << "." << std::endl;
+    }
+    bool isSent{false};
+    for (uint32_t i{0}; i < repeats * m_channels.size(); i++) {
+        std::string const &channel{m_channels[i % m_channels.size()]};
+        std::string const uri{radio + "/" + channel + "/" + kBroadcastAddress};
+        try{
+            switch (cmd.Type) {
+                case 0: // Takeoff
+                    broadcaster(uri).takeoff(cmd.height, cmd.time, cmd.groupMask);
+                    break;
+                case 1: // Land
+                    broadcaster(uri).land(cmd.height, cmd.time, cmd.groupMask);
+                    break;
+                case 2: // Stop
+                    broadcaster(uri).stop(cmd.groupMask);
+                    break;
+                case 3: // Goto, relative like the unicast one
+                    broadcaster(uri).goTo(cmd.x, cmd.y, cmd.z, cmd.yaw, cmd.time, cmd.groupMask);
+                    break;
+                case 7: // Start trajectory
+                    broadcaster(uri).startTrajectory(cmd.trajectoryId, cmd.timescale, cmd.reversed, cmd.relative, cmd.groupMask);
+                    break;
+                default:
+                    std::cerr << "Command type " << cmd.Type << " cannot be broadcast." << std::endl;
+                    reportCommandStatus(m_od4, cmd, kBroadcastFrameId, CommandState::Failed, 0);
+                    return;
+            }
+            isSent = true;
+        }
+        catch(std::exception& e){
+            std::cerr << "Broadcast on " << uri << " failed due to: " << e.what() << std::endl;
+            m_broadcasters.erase(uri);
+        }
+    }
+    if ( isSent ){
+        m_latency.record(cmd, cluon::time::toMicroseconds(cluon::time::now()));
+    }
+    reportCommandStatus(m_od4, cmd, kBroadcastFrameId, isSent ? CommandState::Sent : CommandState::Failed, repeats);
+}
+
+void SwarmBroadcaster::sendPoses(std::string const &radio)
+{
+    std::map<std::string, std::map<uint8_t, CrazyflieBroadcaster::externalPose>> poses;
+    {
+        std::lock_guard<std::mutex> lck(m_posesMutex);
+        poses.swap(m_poses);
+        m_hasPoses = false;
+    }
+    auto const now = std::chrono::steady_clock::now();
+    m_nextPosesNs = std::chrono::duration_cast<std::chrono::nanoseconds>((now + m_posePeriod).time_since_epoch()).count();
+
+    for (auto const &channel : poses) {
+        std::string const uri{radio + "/" + channel.first + "/" + kBroadcastAddress};
+        try{
+            // crazyflie_cpp packs as many drones per packet as fit
+            if ( m_hasOrientation ){
+                std::vector<CrazyflieBroadcaster::externalPose> data;
+                for (auto const &pose : channel.second) {
+                    data.push_back(pose.second);
+                }
+                broadcaster(uri).sendExternalPoses(data);
+            } else {
+                std::vector<CrazyflieBroadcaster::externalPosition> data;
+                for (auto const &pose : channel.second) {
+                    data.push_back(CrazyflieBroadcaster::externalPosition{pose.second.id, pose.second.x, pose.second.y, pose.second.z});
+                }
+                broadcaster(uri).sendExternalPositions(data);
+            }
+        }
+        catch(std::exception& e){
+            std::cerr << "Broadcast on " << uri << " failed due to: " << e.what() << std::endl;
+            m_broadcasters.erase(uri);
+        }
+    }
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SWARM_BROADCASTER_HPP
+#define SWARM_BROADCASTER_HPP
+
+#include "cluon-complete.hpp"
+#include "binary-log.hpp"
+#include "command-latency.hpp"
+#include "command-queue.hpp"
+#include "metered-od4-session.hpp"
+#include "wake-signal.hpp"
+
+#include <crazyflie_cpp/Crazyflie.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Sends takeoff, land, stop, goTo and trajectory starts for a group of
+// drones as a single broadcast packet per radio channel, so that the whole
+// group gets them at the same moment instead of one radio round trip after
+// the other. Drones pick up the commands for the groups set by their group
+// mask.
+//
+// External poses from motion capture go out the same way, the latest pose
+// of every drone on a channel packed together, at most at the pose rate.
+// A Crazyflie picks its own by the last byte of its radio address.
+//
+// Broadcasts are not acknowledged, so their status ends at sent. Takeoff,
+// land and stop are repeated instead, which does no harm to a drone that
+// got them the first time.
+//
+// The broadcasts are sent by the scheduler of whichever radio gets to them
+// first, stops before anything else. They wait for the links of the group
+// to leave low-level setpoints, which would make the drones ignore them.
+class SwarmBroadcaster {
+ private:
+  SwarmBroadcaster(const SwarmBroadcaster &) = delete;
+  SwarmBroadcaster(SwarmBroadcaster &&) = delete;
+  SwarmBroadcaster &operator=(const SwarmBroadcaster &) = delete;
+  SwarmBroadcaster &operator=(SwarmBroadcaster &&) = delete;
+
+ public:
+  // A pose rate of zero disables the external poses, without orientation
+  // only the positions are sent, which packs twice as many drones.
+  SwarmBroadcaster(uint32_t capacity, WakeSignal &wakeSignal,
+      MeteredOD4Session &od4, CommandLatency &latency, BinaryLog &log,
+      uint32_t criticalRepeats, float poseRate, bool hasOrientation);
+
+  // Broadcasts go out on the channel and data rate of every link added, the
+  // external pose of frameId goes to the address of its link. Links must
+  // be added before any pose is updated. Throws std::runtime_error for a
+  // radio link without channel and data rate or with an invalid address.
+  void addChannel(int16_t frameId, std::string const &uri);
+  // Commands are held back while isHeld returns true, set before the
+  // broadcaster is used.
+  void holdWhile(std::function<bool()> isHeld);
+  // Returns false if the command had to be dropped.
+  bool push(command const &cmd) noexcept;
+  // Replaces the external pose of the drone, may be called from any thread.
+  void updatePose(int16_t frameId, float x, float y, float z,
+      float roll, float pitch, float yaw);
+  // Sends the next broadcast, or only a pending stop, through the given
+  // radio. Returns true if something was sent.
+  bool transmit(std::string const &radio, bool stopOnly);
+  // When the next external poses are due.
+  std::chrono::steady_clock::time_point nextDeadline() const noexcept;
+  uint64_t dropped() const noexcept;
+
+ private:
+  CrazyflieBroadcaster &broadcaster(std::string const &uri);
+  void send(std::string const &radio, command const &cmd);
+  void sendPoses(std::string const &radio);
+
+  CommandQueue m_queue;
+  std::function<bool()> m_isHeld;
+  MeteredOD4Session &m_od4;
+  CommandLatency &m_latency;
+  BinaryLog &m_log;
+  uint32_t const m_criticalRepeats;
+  std::vector<std::string> m_channels;
+  // Held by the scheduler that is sending, guards the queue consumer side
+  std::mutex m_sendMutex;
+  std::map<std::string, std::unique_ptr<CrazyflieBroadcaster>> m_broadcasters;
+
+  WakeSignal &m_wakeSignal;
+  std::chrono::nanoseconds const m_posePeriod;
+  bool const m_hasOrientation;
+  struct PoseTarget {
+    std::string channel;
+    uint8_t id;
+  };
+  // Channel and Crazyflie id of every frameId, only changed by addChannel
+  std::map<int16_t, PoseTarget> m_targets;
+  std::mutex m_posesMutex;
+  // Latest pose per channel and Crazyflie id
+  std::map<std::string, std::map<uint8_t, CrazyflieBroadcaster::externalPose>> m_poses;
+  std::atomic<bool> m_hasPoses;
+  std::atomic<int64_t> m_nextPosesNs;
+};
+
+#endif
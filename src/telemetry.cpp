@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "telemetry.hpp"
+#include "opendlv-standard-message-set.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+
+namespace {
+// In the order of Telemetry::Variable
+char const *const kVariableNames[] = {
+    "stateEstimate.x", "stateEstimate.y", "stateEstimate.z",
+    "stateEstimate.roll", "stateEstimate.pitch", "stateEstimate.yaw",
+    "stateEstimateZ.x", "stateEstimateZ.y", "stateEstimateZ.z", "stateEstimateZ.quat",
+    "stateEstimate.vx", "stateEstimate.vy", "stateEstimate.vz",
+    "gyro.x", "gyro.y", "gyro.z",
+    "stateEstimateZ.vx", "stateEstimateZ.vy", "stateEstimateZ.vz",
+    "stateEstimateZ.rateRoll", "stateEstimateZ.ratePitch", "stateEstimateZ.rateYaw",
+    "pm.vbat"
+};
+
+float const kDegreesToRadians{static_cast<float>(M_PI) / 180.0f};
+
+uint32_t sizeOf(Crazyflie::LogType type)
+{
+    switch (type) {
+        case Crazyflie::LogTypeUint8:
+        case Crazyflie::LogTypeInt8:
+            return 1;
+        case Crazyflie::LogTypeUint16:
+        case Crazyflie::LogTypeInt16:
+        case Crazyflie::LogTypeFP16:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+// Inverse of quatcompress() in the Crazyflie firmware: the index of the
+// largest component in the top two bits, the three others as sign and 9 bit
+// magnitude scaled by 1/sqrt(2). q is (x, y, z, w).
+void decompressQuaternion(uint32_t comp, float q[4])
+{
+    float const smallMax{1.0f / std::sqrt(2.0f)};
+    uint32_t const mask{(1 << 9) - 1};
+
+    uint32_t const largest{comp >> 30};
+    float sumSquares{0.0f};
+    for (int32_t i{3}; i >= 0; --i) {
+        if ( static_cast<uint32_t>(i) != largest ){
+            uint32_t const magnitude{comp & mask};
+            bool const isNegative{0 != ((comp >> 9) & 0x1)};
+            comp = comp >> 10;
+            q[i] = smallMax * static_cast<float>(magnitude) / static_cast<float>(mask);
+            if ( isNegative ){
+                q[i] = -q[i];
+            }
+            sumSquares += q[i] * q[i];
+        }
+    }
+    q[largest] = std::sqrt(std::max(0.0f, 1.0f - sumSquares));
+}
+}
+
+Telemetry::Telemetry(std::vector<LogGroup> const &groups, int16_t frameId,
+    MeteredOD4Session &od4, BinaryLog &log, bool verbose)
+  : m_groups(groups)
+  , m_frameId(frameId)
+  , m_od4(od4)
+  , m_log(log)
+  , m_verbose(verbose)
+  , m_blocks()
+  , m_callback()
+  , m_isLogged()
+  , m_values()
+  , m_lastSample()
+  , m_packetsPerSecond(0)
+  , m_clockSync(2048)
+  , m_linkDelay()
+  , m_publishDelay()
+  , m_jitter()
+  , m_missedPeriods(0)
+  , m_latePeriods(0)
+  , m_driftPpm(0.0)
+{
+    m_callback = [this](uint32_t timeInMs, std::vector<double> *values, void *userData) {
+        onBlockData(*static_cast<Block *>(userData), timeInMs, *values);
+    };
+    m_isLogged.fill(false);
+    m_values.fill(0.0);
+}
+
+void Telemetry::createBlocks(Crazyflie &cf)
+{
+    std::map<std::string, uint32_t> sizes;
+    for (auto entry = cf.logVariablesBegin(); entry != cf.logVariablesEnd(); ++entry) {
+        sizes[entry->group + "." + entry->name] = sizeOf(entry->type);
+    }
+
+    m_isLogged.fill(false);
+    m_blocks.clear();
+    uint32_t packetsPerSecond{0};
+    for (auto const &layout : packLogBlocks(m_groups, sizes)) {
+        std::unique_ptr<Block> block(new Block{layout, {}, false, false, nullptr, false, 0, 0});
+        for (auto const &name : layout.variables) {
+            auto const known = std::find(std::begin(kVariableNames), std::end(kVariableNames), name);
+            uint32_t const variable{static_cast<uint32_t>(known - std::begin(kVariableNames))};
+            block->variables.push_back(variable);
+            if ( variable < VariableCount ){
+                m_isLogged[variable] = true;
+            }
+            block->hasPose |= (X == variable || ZX == variable);
+            block->hasKinematic |= (Vx == variable || ZVx == variable);
+        }
+        block->logBlock.reset(new LogBlockGeneric(&cf, layout.variables, block.get(), m_callback));
+
+        std::cout << "Log block " << m_blocks.size() << ": every " << 10 * static_cast<uint32_t>(layout.period) << " ms, " << layout.size << " bytes:";
+        for (auto const &name : layout.variables) {
+            std::cout << " " << name;
+        }
+        std::cout << std::endl;
+        packetsPerSecond += 100 / layout.period;
+        m_blocks.push_back(std::move(block));
+    }
+    std::cout << "Telemetry uses " << packetsPerSecond << " packets per second." << std::endl;
+    m_packetsPerSecond = packetsPerSecond;
+}
+
+void Telemetry::startBlocks()
+{
+    for (auto const &block : m_blocks) {
+        block->logBlock->start(block->layout.period);
+    }
+}
+
+void Telemetry::abandonBlocks() noexcept
+{
+    for (auto &block : m_blocks) {
+        block->logBlock.release();
+    }
+    m_blocks.clear();
+}
+
+bool Telemetry::hasBlocks() const noexcept
+{
+    return !m_blocks.empty();
+}
+
+void Telemetry::resetClock() noexcept
+{
+    m_clockSync.reset();
+}
+
+std::chrono::steady_clock::time_point Telemetry::lastSample() const noexcept
+{
+    return m_lastSample;
+}
+
+std::chrono::milliseconds Telemetry::fastestPeriod() const noexcept
+{
+    uint32_t period{255};
+    for (auto const &block : m_blocks) {
+        period = std::min<uint32_t>(period, block->layout.period);
+    }
+    return std::chrono::milliseconds(10 * period);
+}
+
+uint32_t Telemetry::packetsPerSecond() const noexcept
+{
+    return m_packetsPerSecond;
+}
+
+uint64_t Telemetry::packetsReceived() const noexcept
+{
+    return m_linkDelay.count();
+}
+
+void Telemetry::publishStatistics() const
+{
+    cluon::data::TimeStamp const now{cluon::time::now()};
+    LatencyHistogram const *const stages[] = {&m_linkDelay, &m_publishDelay, &m_jitter};
+    for (uint8_t stage{0}; stage < 3; stage++) {
+        LatencyHistogram const &latency = *stages[stage];
+        opendlv::system::CrazyFlieTelemetryLatency message;
+        message.stage(stage);
+        message.count(latency.count());
+        message.mean(static_cast<uint32_t>(latency.mean()));
+        message.p50(static_cast<uint32_t>(latency.percentile(50.0)));
+        message.p90(static_cast<uint32_t>(latency.percentile(90.0)));
+        message.p99(static_cast<uint32_t>(latency.percentile(99.0)));
+        message.p999(static_cast<uint32_t>(latency.percentile(99.9)));
+        message.max(static_cast<uint32_t>(latency.max()));
+        message.missedPeriods(m_missedPeriods);
+        message.latePeriods(m_latePeriods);
+        message.clockDrift(static_cast<float>(m_driftPpm.load()));
+        m_od4.send(message, now, m_frameId);
+    }
+}
+
+void Telemetry::printStatistics() const
+{
+    char const *const names[] = {"sample to receive", "receive to publish", "period jitter"};
+    LatencyHistogram const *const stages[] = {&m_linkDelay, &m_publishDelay, &m_jitter};
+    for (uint32_t stage{0}; stage < 3; stage++) {
+        LatencyHistogram const &latency = *stages[stage];
+        std::cout << "Telemetry of frame " << m_frameId << ", " << names[stage] << ": " << latency.count() << " packet(s), mean " << latency.mean() << " us, p50 " << latency.percentile(50.0) << " us, p99 " << latency.percentile(99.0) << " us, p99.9 " << latency.percentile(99.9) << " us, max " << latency.max() << " us." << std::endl;
+    }
+    std::cout << "Telemetry of frame " << m_frameId << ": " << m_missedPeriods << " period(s) missed, " << m_latePeriods << " late, clock drift " << m_driftPpm.load() << " ppm." << std::endl;
+}
+
+void Telemetry::updateStatistics(Block &block, uint32_t timeInMs, int64_t sampleUs, int64_t receivedUs) noexcept
+{
+    int64_t const periodUs{10000 * static_cast<int64_t>(block.layout.period)};
+    // The clock offset follows the least delayed packets, so this is the
+    // delay on top of the quickest way through radio and USB
+    m_linkDelay.record(receivedUs - sampleUs);
+    if ( receivedUs - sampleUs > periodUs ){
+        m_latePeriods++;
+    }
+    if ( block.hasReceived ){
+        // Onboard samples are taken on the period, a gap of several periods
+        // means packets were lost
+        int64_t const gapUs{1000 * static_cast<int64_t>(static_cast<uint32_t>(timeInMs - block.lastSampleMs))};
+        int64_t const periods{(gapUs + periodUs / 2) / periodUs};
+        if ( periods > 1 ){
+            m_missedPeriods += static_cast<uint64_t>(periods - 1);
+        }
+        m_jitter.record(std::abs(receivedUs - block.lastReceivedUs - periods * periodUs));
+    }
+    block.hasReceived = true;
+    block.lastSampleMs = timeInMs;
+    block.lastReceivedUs = receivedUs;
+}
+
+void Telemetry::onBlockData(Block &block, uint32_t timeInMs, std::vector<double> const &values)
+{
+    TraceScope trace(m_log, TraceEvent::LogCallback, m_frameId);
+    m_lastSample = std::chrono::steady_clock::now();
+    // Stamp the messages with the time the Crazyflie took the sample rather
+    // than with the time they happen to be sent
+    int64_t const receivedUs{cluon::time::toMicroseconds(cluon::time::now())};
+    int64_t const sampleUs{m_clockSync.update(timeInMs, receivedUs)};
+    m_driftPpm.store(m_clockSync.driftPpm(), std::memory_order_relaxed);
+    cluon::data::TimeStamp const sampleTime{cluon::time::fromMicroseconds(sampleUs)};
+    updateStatistics(block, timeInMs, sampleUs, receivedUs);
+
+    for (size_t i{0}; i < values.size() && i < block.variables.size(); i++) {
+        uint32_t const variable{block.variables[i]};
+        if ( variable < VariableCount ){
+            m_values[variable] = values[i];
+        } else {
+            opendlv::logic::sensation::CrazyFlieLogVariable logVariable;
+            logVariable.name(block.layout.variables[i]);
+            logVariable.value(values[i]);
+            m_od4.send(logVariable, sampleTime, m_frameId);
+        }
+    }
+
+    if ( block.hasPose ){
+        publishPose(sampleTime);
+    }
+    if ( block.hasKinematic ){
+        publishKinematicState(sampleTime);
+    }
+    m_publishDelay.record(cluon::time::toMicroseconds(cluon::time::now()) - receivedUs);
+}
+
+bool Telemetry::isLogged(Variable variable) const noexcept
+{
+    return m_isLogged[variable];
+}
+
+float Telemetry::value(Variable variable) const noexcept
+{
+    return static_cast<float>(m_values[variable]);
+}
+
+void Telemetry::publishPose(cluon::data::TimeStamp const &sampleTime)
+{
+    float x{value(X)};
+    float y{value(Y)};
+    float z{value(Z)};
+    if ( isLogged(ZX) ){
+        x = value(ZX) / 1000.0f;
+        y = value(ZY) / 1000.0f;
+        z = value(ZZ) / 1000.0f;
+    }
+
+    float roll{value(Roll) * kDegreesToRadians};
+    float pitch{value(Pitch) * kDegreesToRadians};
+    float yaw{value(Yaw) * kDegreesToRadians};
+    if ( isLogged(ZQuat) ){
+        float q[4];
+        decompressQuaternion(static_cast<uint32_t>(m_values[ZQuat]), q);
+        float const qx{q[0]};
+        float const qy{q[1]};
+        float const qz{q[2]};
+        float const qw{q[3]};
+        roll = std::atan2(2.0f * (qw * qx + qy * qz), 1.0f - 2.0f * (qx * qx + qy * qy));
+        // stateEstimate.pitch is logged with inverted sign by the firmware,
+        // keep the published pitch the same in both modes
+        pitch = -std::asin(std::min(1.0f, std::max(-1.0f, 2.0f * (qw * qy - qx * qz))));
+        yaw = std::atan2(2.0f * (qw * qz + qx * qy), 1.0f - 2.0f * (qy * qy + qz * qz));
+    }
+
+    if ( m_verbose && m_log.isOpen() ){
+        m_log.log(LogEvent::Pose, m_frameId, {x, y, z, roll, pitch, yaw, value(Vbat)});
+    } else if ( m_verbose ){
+        std::cout << "Message received, x:" << x << ", y:" << y << ", z:" << z << ", roll:" << roll << ", pitch:" << pitch << ", yaw:" << yaw << ", voltage:" << value(Vbat) << std::endl;
+    }
+
+    // Send message by od4, the state keeps the pose rate and carries the
+    // latest battery voltage
+    opendlv::sim::Frame frame;
+    opendlv::logic::sensation::CrazyFlieState cfState;
+    cfState.battery_state(value(Vbat));
+    cfState.cur_yaw(yaw);
+
+    frame.x(x);
+    frame.y(y);
+    frame.z(z);
+    frame.roll(roll);
+    frame.pitch(pitch);
+    frame.yaw(yaw);
+
+    m_od4.send(frame, sampleTime, m_frameId);
+    m_od4.send(cfState, sampleTime, m_frameId);
+}
+
+void Telemetry::publishKinematicState(cluon::data::TimeStamp const &sampleTime)
+{
+    opendlv::sim::KinematicState kinematicState;
+    if ( isLogged(ZVx) ){
+        // ratePitch already has the sign of stateEstimate.pitch
+        kinematicState.vx(value(ZVx) / 1000.0f);
+        kinematicState.vy(value(ZVy) / 1000.0f);
+        kinematicState.vz(value(ZVz) / 1000.0f);
+        kinematicState.rollRate(value(ZRateRoll) / 1000.0f);
+        kinematicState.pitchRate(value(ZRatePitch) / 1000.0f);
+        kinematicState.yawRate(value(ZRateYaw) / 1000.0f);
+    } else {
+        // gyro.y is inverted to match the sign of the published pitch
+        kinematicState.vx(value(Vx));
+        kinematicState.vy(value(Vy));
+        kinematicState.vz(value(Vz));
+        kinematicState.rollRate(value(GyroX) * kDegreesToRadians);
+        kinematicState.pitchRate(-value(GyroY) * kDegreesToRadians);
+        kinematicState.yawRate(value(GyroZ) * kDegreesToRadians);
+    }
+    m_od4.send(kinematicState, sampleTime, m_frameId);
+}
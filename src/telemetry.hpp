@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TELEMETRY_HPP
+#define TELEMETRY_HPP
+
+#include "cluon-complete.hpp"
+#include "binary-log.hpp"
+#include "clock-sync.hpp"
+#include "latency-histogram.hpp"
+#include "log-layout.hpp"
+#include "metered-od4-session.hpp"
+
+#include <crazyflie_cpp/Crazyflie.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Turns log blocks into OD4 messages. The wanted variables are packed into
+// log blocks once the log TOC is known, every block arriving updates the
+// latest values and publishes the messages it carries the data for:
+//  - stateEstimate(Z) position as Frame and CrazyFlieState,
+//  - stateEstimate(Z) velocity and body rates as KinematicState,
+//  - anything else as CrazyFlieLogVariable.
+// All messages are stamped with the onboard sample time mapped to host time.
+// Verbose poses go to the binary log if it is open.
+//
+// How long the samples take on their way is kept as statistics: from the
+// sample time to the packet being received, from there to the messages
+// being sent, and how much the time between two packets of a block varies.
+// Periods the Crazyflie did not send a block for count as missed, packets
+// received more than a period after their sample time count as late. The
+// drift of the onboard clock is reported with them.
+class Telemetry {
+ private:
+  Telemetry(const Telemetry &) = delete;
+  Telemetry(Telemetry &&) = delete;
+  Telemetry &operator=(const Telemetry &) = delete;
+  Telemetry &operator=(Telemetry &&) = delete;
+
+ public:
+  Telemetry(std::vector<LogGroup> const &groups, int16_t frameId,
+      MeteredOD4Session &od4, BinaryLog &log, bool verbose);
+
+  // Lays out and creates the log blocks, the log TOC of cf must be loaded.
+  void createBlocks(Crazyflie &cf);
+  void startBlocks();
+  // Forgets the blocks without talking to the link. Deleting a log block
+  // talks to its link, which might be gone, and LogBlockGeneric throws from
+  // its destructor in that case.
+  void abandonBlocks() noexcept;
+  bool hasBlocks() const noexcept;
+  void resetClock() noexcept;
+
+  std::chrono::steady_clock::time_point lastSample() const noexcept;
+  std::chrono::milliseconds fastestPeriod() const noexcept;
+  // Log packets per second of the current layout.
+  uint32_t packetsPerSecond() const noexcept;
+
+  // May be called from any thread.
+  uint64_t packetsReceived() const noexcept;
+  void publishStatistics() const;
+  void printStatistics() const;
+
+ private:
+  // Variables with a dedicated message
+  enum Variable : uint32_t {
+    X, Y, Z, Roll, Pitch, Yaw,
+    ZX, ZY, ZZ, ZQuat,
+    Vx, Vy, Vz, GyroX, GyroY, GyroZ,
+    ZVx, ZVy, ZVz, ZRateRoll, ZRatePitch, ZRateYaw,
+    Vbat,
+    VariableCount
+  };
+
+  struct Block {
+    LogBlockLayout layout;
+    // Variable of each value, VariableCount for the ones without message
+    std::vector<uint32_t> variables;
+    bool hasPose;
+    bool hasKinematic;
+    std::unique_ptr<LogBlockGeneric> logBlock;
+    // Onboard and host time of the latest packet
+    bool hasReceived;
+    uint32_t lastSampleMs;
+    int64_t lastReceivedUs;
+  };
+
+  void updateStatistics(Block &block, uint32_t timeInMs, int64_t sampleUs, int64_t receivedUs) noexcept;
+  void onBlockData(Block &block, uint32_t timeInMs, std::vector<double> const &values);
+  bool isLogged(Variable variable) const noexcept;
+  float value(Variable variable) const noexcept;
+  void publishPose(cluon::data::TimeStamp const &sampleTime);
+  void publishKinematicState(cluon::data::TimeStamp const &sampleTime);
+
+  std::vector<LogGroup> const m_groups;
+  int16_t const m_frameId;
+  MeteredOD4Session &m_od4;
+  BinaryLog &m_log;
+  bool const m_verbose;
+
+  std::vector<std::unique_ptr<Block>> m_blocks;
+  std::function<void(uint32_t, std::vector<double> *, void *)> m_callback;
+  std::array<bool, VariableCount> m_isLogged;
+  std::array<double, VariableCount> m_values;
+  std::chrono::steady_clock::time_point m_lastSample;
+  std::atomic<uint32_t> m_packetsPerSecond;
+  ClockSync m_clockSync;
+
+  LatencyHistogram m_linkDelay;
+  LatencyHistogram m_publishDelay;
+  LatencyHistogram m_jitter;
+  std::atomic<uint64_t> m_missedPeriods;
+  std::atomic<uint64_t> m_latePeriods;
+  // Of the clock sync, which is only used by the thread of the link
+  std::atomic<double> m_driftPpm;
+};
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "toc-cache.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+bool makeDirectories(std::string const &path)
+{
+    std::string::size_type pos{0};
+    do {
+        pos = path.find('/', pos + 1);
+        std::string const parent{path.substr(0, pos)};
+        if ( !parent.empty() && 0 != ::mkdir(parent.c_str(), 0755) && EEXIST != errno ){
+            return false;
+        }
+    } while (std::string::npos != pos);
+    struct stat info;
+    return 0 == ::stat(path.c_str(), &info) && S_ISDIR(info.st_mode);
+}
+}
+
+TocCache::TocCache(std::string const &directory)
+{
+    if ( !makeDirectories(directory) || 0 != ::chdir(directory.c_str()) ){
+        std::cerr << "TOC cache directory " << directory << " is not usable, the TOC will be cached in the working directory." << std::endl;
+    }
+}
+
+void TocCache::requestLogToc(Crazyflie &cf)
+{
+    auto const start = std::chrono::steady_clock::now();
+    try{
+        cf.requestLogToc();
+    }
+    catch(std::exception& e){
+        // An unreadable cache file must not keep the link down
+        std::cerr << "Cached log TOC unusable (" << e.what() << "), fetching it again." << std::endl;
+        cf.requestLogToc(true);
+    }
+    auto const duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::cout << "Log TOC ready after " << duration.count() << " ms." << std::endl;
+}
+
+std::string absolutePath(std::string const &path)
+{
+    if ( path.empty() || '/' == path[0] ){
+        return path;
+    }
+    std::vector<char> buffer(4096);
+    if ( nullptr == ::getcwd(buffer.data(), buffer.size()) ){
+        return path;
+    }
+    return std::string(buffer.data()) + "/" + path;
+}
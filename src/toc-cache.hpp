@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TOC_CACHE_HPP
+#define TOC_CACHE_HPP
+
+#include <crazyflie_cpp/Crazyflie.h>
+
+#include <string>
+
+// crazyflie_cpp stores the log TOC it downloads in the current working
+// directory, one file per TOC CRC reported by the firmware ("log<crc>.csv"),
+// and only fetches the full TOC over the radio when there is no file for
+// that CRC. The file name is relative and cannot be given to the library,
+// so TocCache makes a persistent directory the working directory of the
+// process, once, so that the cache survives restarts of the process and of
+// its container.
+//
+// The working directory is process wide: TocCache must be constructed
+// before any thread is started, and relative paths given to the process
+// must be made absolute with absolutePath() before.
+class TocCache {
+ private:
+  TocCache(const TocCache &) = delete;
+  TocCache(TocCache &&) = delete;
+  TocCache &operator=(const TocCache &) = delete;
+  TocCache &operator=(TocCache &&) = delete;
+
+ public:
+  explicit TocCache(std::string const &directory);
+
+  // Loads the log TOC from the cache, or from the radio if the CRC changed.
+  void requestLogToc(Crazyflie &cf);
+};
+
+// The path relative to the current working directory as an absolute one.
+std::string absolutePath(std::string const &path);
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "trajectory.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+// OD4 is little-endian on the wire, as is every host this runs on
+std::vector<float> unpackFloats(std::string const &bytes, uint32_t stride, char const *what)
+{
+    if ( bytes.size() % (stride * sizeof(float)) != 0 ){
+        throw std::runtime_error(std::string("Trajectory ") + what + " of " + std::to_string(bytes.size()) + " bytes, expected multiples of " + std::to_string(stride) + " floats");
+    }
+    std::vector<float> values(bytes.size() / sizeof(float));
+    std::memcpy(values.data(), bytes.data(), bytes.size());
+    return values;
+}
+
+void checkLength(size_t pieces)
+{
+    if ( pieces > kMaxTrajectoryPieces ){
+        throw std::runtime_error("Trajectory of " + std::to_string(pieces) + " pieces, the trajectory memory holds " + std::to_string(kMaxTrajectoryPieces));
+    }
+}
+}
+
+std::vector<Crazyflie::poly4d> unpackPieces(std::string const &bytes)
+{
+    uint32_t const stride{1 + 4 * 8};
+    std::vector<float> const values{unpackFloats(bytes, stride, "pieces")};
+    std::vector<Crazyflie::poly4d> pieces(values.size() / stride);
+    checkLength(pieces.size());
+    for (size_t i{0}; i < pieces.size(); i++) {
+        float const *piece{&values[i * stride]};
+        pieces[i].duration = piece[0];
+        for (uint32_t axis{0}; axis < 4; axis++) {
+            for (uint32_t k{0}; k < 8; k++) {
+                pieces[i].p[axis][k] = piece[1 + axis * 8 + k];
+            }
+        }
+    }
+    return pieces;
+}
+
+std::vector<Crazyflie::poly4d> fitWaypoints(std::string const &bytes)
+{
+    uint32_t const stride{5};
+    std::vector<float> const values{unpackFloats(bytes, stride, "waypoints")};
+    size_t const count{values.size() / stride};
+    if ( count < 2 ){
+        throw std::runtime_error("A trajectory needs at least two waypoints");
+    }
+    checkLength(count - 1);
+    auto t = [&values](size_t i) { return values[i * 5]; };
+    auto p = [&values](size_t i, uint32_t axis) { return values[i * 5 + 1 + axis]; };
+    for (size_t i{1}; i < count; i++) {
+        if ( t(i) <= t(i - 1) ){
+            throw std::runtime_error("Waypoint times have to increase");
+        }
+    }
+    // Catmull-Rom like velocities, at rest at both ends
+    auto v = [&t, &p, count](size_t i, uint32_t axis) {
+        if ( 0 == i || count - 1 == i ){
+            return 0.0f;
+        }
+        return (p(i + 1, axis) - p(i - 1, axis)) / (t(i + 1) - t(i - 1));
+    };
+
+    std::vector<Crazyflie::poly4d> pieces(count - 1);
+    for (size_t i{0}; i + 1 < count; i++) {
+        Crazyflie::poly4d &piece = pieces[i];
+        std::memset(&piece, 0, sizeof(piece));
+        float const duration{t(i + 1) - t(i)};
+        piece.duration = duration;
+        for (uint32_t axis{0}; axis < 4; axis++) {
+            // Cubic Hermite segment between the two waypoints
+            float const p0{p(i, axis)};
+            float const p1{p(i + 1, axis)};
+            float const v0{v(i, axis)};
+            float const v1{v(i + 1, axis)};
+            piece.p[axis][0] = p0;
+            piece.p[axis][1] = v0;
+            piece.p[axis][2] = (3.0f * (p1 - p0) / duration - 2.0f * v0 - v1) / duration;
+            piece.p[axis][3] = (2.0f * (p0 - p1) / duration + v0 + v1) / (duration * duration);
+        }
+    }
+    return pieces;
+}
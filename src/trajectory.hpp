@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TRAJECTORY_HPP
+#define TRAJECTORY_HPP
+
+#include "command-queue.hpp"
+
+#include <crazyflie_cpp/Crazyflie.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The trajectory memory of the Crazyflie holds 4 kB, as uncompressed
+// pieces of 33 floats each.
+constexpr uint32_t kMaxTrajectoryPieces{4096 / sizeof(Crazyflie::poly4d)};
+
+// A trajectory to upload into the trajectory memory and maybe start once
+// it is there.
+struct TrajectoryUpload {
+  uint8_t trajectoryId;
+  std::vector<Crazyflie::poly4d> pieces;
+  bool start;
+  float timescale;
+  bool relative;
+  bool reversed;
+  // The message as a start command (type 7), for the status of the upload
+  command request;
+  // Attempts that failed so far
+  uint32_t failures;
+};
+
+// Reads pieces packed as little-endian float32, per piece the duration and
+// then 8 coefficients (constant term first) for each of x, y, z and yaw.
+// Throws std::runtime_error on a malformed or too long trajectory.
+std::vector<Crazyflie::poly4d> unpackPieces(std::string const &bytes);
+
+// Reads waypoints packed as little-endian float32 t, x, y, z, yaw and fits
+// cubic pieces through them: the velocity at a waypoint follows the
+// neighbouring ones, the trajectory starts and ends at rest. Throws
+// std::runtime_error if there are less than two waypoints, the times do not
+// increase, or the result is too long.
+std::vector<Crazyflie::poly4d> fitWaypoints(std::string const &bytes);
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WAKE_SIGNAL_HPP
+#define WAKE_SIGNAL_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// Wakes up a thread that services several lock-free sources. The waiter
+// reads generation() before it checks its sources and passes it to
+// waitUntil(), so a notify() in between is never lost.
+class WakeSignal {
+ private:
+  WakeSignal(const WakeSignal &) = delete;
+  WakeSignal(WakeSignal &&) = delete;
+  WakeSignal &operator=(const WakeSignal &) = delete;
+  WakeSignal &operator=(WakeSignal &&) = delete;
+
+ public:
+  WakeSignal() = default;
+
+  void notify() noexcept {
+    {
+      std::lock_guard<std::mutex> lck(m_mutex);
+      m_generation++;
+    }
+    m_condition.notify_all();
+  }
+
+  uint64_t generation() noexcept {
+    std::lock_guard<std::mutex> lck(m_mutex);
+    return m_generation;
+  }
+
+  // Returns true if notify() was called since generation was read.
+  bool waitUntil(uint64_t generation, std::chrono::steady_clock::time_point deadline) noexcept {
+    std::unique_lock<std::mutex> lck(m_mutex);
+    return m_condition.wait_until(lck, deadline, [this, generation](){
+        return m_generation != generation;
+      });
+  }
+
+ private:
+  std::mutex m_mutex{};
+  std::condition_variable m_condition{};
+  uint64_t m_generation{0};
+};
+
+#endif